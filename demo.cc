@@ -1,4 +1,5 @@
 #include "src/nn.h"
+#include "src/nn_export.h"
 #include <fstream>
 #include <iostream>
 
@@ -25,7 +26,7 @@ int main(){
 
     // save the computation graph to graphviz format
     std::ofstream file("model.gv");
-    file << graph.to_graphviz();
+    nn::write_graphviz(graph, file);
     file.close();
 
     std::cout << "Success, check computational graph: 'model.gv'" << std::endl;
@@ -1,10 +1,16 @@
 #include "src/nn.h"
 #include "src/nn_blocks.h"
+#include "src/nn_data.h"
+#include "src/nn_quant.h"
+#include "src/nn_shm.h"
 #include "utils/bitmap.h"
 
+#include <cstdlib>
 #include <iostream>
+#include <memory>
 #include <random>
-#include <array>
+#include <sys/wait.h>
+#include <unistd.h>
 
 using nn::fp_t;
 
@@ -25,19 +31,12 @@ float aim_levelset(float x, float y){
         );
 };
 
-template <size_t N>
-std::array<fp_t[3], N> get_samples(){
-    static std::random_device rd;
-    static std::mt19937 generator(rd());
-    static std::uniform_real_distribution<fp_t> dist(-5, 5);
-    std::array<fp_t[3], N> samples;
-    for (size_t i = 0; i < N; i++){
-        auto x = dist(generator);
-        auto y = dist(generator);
-        auto z = static_cast<fp_t>(aim_levelset(x, y) < 0);
-        samples[i][0] = x; samples[i][1] = y; samples[i][2] = z;
-    }
-    return samples;
+// sample = (x, y, inside the aim region); the loader's thread and evaluation use their own generators
+void get_sample(fp_t* sample, std::mt19937& generator){
+    std::uniform_real_distribution<fp_t> dist(-5, 5);
+    auto x = dist(generator);
+    auto y = dist(generator);
+    sample[0] = x; sample[1] = y; sample[2] = static_cast<fp_t>(aim_levelset(x, y) < 0);
 }
 
 struct Model{
@@ -47,10 +46,10 @@ struct Model{
     nn::NodeProxy aim;
     nn::NodeProxy prediciton;
     nn::NodeProxy loss;
+    std::vector<nn::Node*> params;
 };
 
 Model create_model(nn::Graph& graph){
-    std::vector<nn::Node*> params;
     auto input_x = graph.variable();
     auto input_y = graph.variable();
     auto output_aim = graph.variable();
@@ -74,77 +73,146 @@ Model create_model(nn::Graph& graph){
     const fp_t eps = 1e-7;
     auto bce_loss = -output_aim * (prediciton + eps).log() - (1 - output_aim) * (1 - prediciton + eps).log();
 
+    std::vector<nn::Node*> params;
+    for (auto node: graph.nodes){
+        if (!node->requires_grad || node->op != nullptr) continue;
+        if (node == input_x.ptr || node == input_y.ptr || node == output_aim.ptr) continue;
+        params.push_back(node);
+    }
+
     return Model{
         &graph,
         input_x,
         input_y,
         output_aim,
         prediciton,
-        bce_loss
+        bce_loss,
+        params
     };
 }
 
-void train_step(Model& model, int n_iter, int total_iter){
+const int batch_size = 32;
+
+// one SGD step on the next batch, the whole batch runs as one pass over the graph.
+// With a group, every process computes the gradients of its share of the
+// batch and the sums are exchanged before the identical update on all of them.
+// Returns false, without updating, once the loader is exhausted.
+bool train_step(Model& model, nn::DataLoader& loader, nn::Batch& batch, int n_iter, int total_iter, nn::ShmGroup* group, fp_t& loss){
     float lr = 1e-2;
-    const int batch_size = 32;
+    auto& params = model.params;
 
-    fp_t loss = 0;
-    std::vector<fp_t> grad_sums = std::vector<fp_t>(model.graph->nodes.size(), 0);
-    for (auto [x, y, z] : get_samples<batch_size>()){
-        model.input_x.set_value(x);
-        model.input_y.set_value(y);
-        model.aim.set_value(z);
-        model.graph->forward();
-        model.graph->backward(model.loss);
-        for (std::size_t i = 0; i < model.graph->nodes.size(); i++){
-            grad_sums[i] += model.graph->nodes[i]->grad;
-        }
-        loss += model.loss.value();
-        model.graph->clear_grad();
-    }
+    nn::Minibatch samples;
+    if (!loader.next(samples)) return false;
+    samples.load(batch, {model.input_x.ptr, model.input_y.ptr, model.aim.ptr});
+    model.graph->forward(batch);
+    model.graph->backward(batch, model.loss.ptr);
+
+    // gradient sums of the parameters, the loss and the sample count; the lanes
+    // padding a short batch are left out
+    std::vector<fp_t> sums(params.size() + 2, 0);
+    for (std::size_t i = 0; i < params.size(); i++) sums[i] = batch.grad_sum(params[i], samples.size);
+    for (std::size_t i = 0; i < samples.size; i++) sums[params.size()] += batch.value(model.loss.ptr)[i];
+    sums.back() = samples.size;
+    if (group != nullptr) group->all_reduce(sums.data(), sums.size());
+    const fp_t n_samples = sums.back();
 
-    for (std::size_t i = 0; i < model.graph->nodes.size(); i++){
-        if (!model.graph->nodes[i]->requires_grad) continue;
+    for (std::size_t i = 0; i < params.size(); i++){
         const fp_t clip_threshold = 1e3;
-        auto grad = grad_sums[i] / batch_size;
+        auto grad = sums[i] / n_samples;
         if (grad > clip_threshold) grad = clip_threshold;
         if (grad < -clip_threshold) grad = -clip_threshold;
-        model.graph->nodes[i]->value -= lr * grad;
+        params[i]->value -= lr * grad;
+        batch.fill(params[i], params[i]->value);
     }
 
-    if ((n_iter + 1) % (int)1e4 == 0) {
+    loss = sums[params.size()] / n_samples;
+    if ((n_iter + 1) % (int)1e4 == 0 && (group == nullptr || group->rank == 0)) {
         std::cout << "Iteration [" << n_iter + 1 << "/" << total_iter << "]"
-        << ", loss: " << loss / batch_size << std::endl;
+        << ", loss: " << loss << std::endl;
     }
-    model.graph->clear_grad();
+    batch.clear_grad();
+    return true;
 }
 
 void save_bitmap(Model& model);
 
-int main(){
+// post-training int8 quantization of the trained layers, against the double graph
+void report_int8(Model& model, std::mt19937& generator){
+    const int n = 5000;
+    std::vector<fp_t> calibration(n * 2), test(n * 2), labels(n);
+    for (int i = 0; i < n; i++){
+        fp_t sample[3];
+        get_sample(sample, generator);
+        calibration[i * 2] = sample[0]; calibration[i * 2 + 1] = sample[1];
+        get_sample(sample, generator);
+        test[i * 2] = sample[0]; test[i * 2 + 1] = sample[1]; labels[i] = sample[2];
+    }
+    std::vector<nn::Node*> inputs = {model.input_x.ptr, model.input_y.ptr}, outputs = {model.prediciton.ptr};
+    auto mlp = nn::quantize_mlp(*model.graph, inputs, outputs, calibration.data(), n);
+    auto report = nn::compare_quantized(*model.graph, inputs, outputs, mlp, test.data(), n, labels.data());
+    std::cout << "int8: acc " << report.int8_accuracy << " (" << std::showpos << report.accuracy_delta() << std::noshowpos
+        << " vs double), max |error| " << report.max_abs_error << ", parameters " << mlp.weight_bytes() << " bytes vs "
+        << model.params.size() * sizeof(fp_t) << std::endl;
+}
+
+// usage: demo_mlp [n_processes], the processes split each batch between them
+int main(int argc, char** argv){
+    const int n_ranks = argc > 1 ? std::max(1, std::atoi(argv[1])) : 1;
+    if (batch_size % n_ranks != 0){
+        std::cerr << "the batch size (" << batch_size << ") must be a multiple of the number of processes" << std::endl;
+        return 1;
+    }
+    int rank = 0;
+    const std::string group_name = "/mgrad_demo_mlp_" + std::to_string(getpid());
+    for (int r = 1; r < n_ranks && rank == 0; r++){
+        if (fork() == 0) rank = r;
+    }
+
     nn::Graph graph;
 
     Model model = create_model(graph);
+    std::mt19937 train_generator(std::random_device{}());
+    nn::GeneratorSource source(3, [&train_generator](fp_t* sample){ get_sample(sample, train_generator); });
+    nn::DataLoader loader(source, batch_size / n_ranks);
+
+    std::unique_ptr<nn::ShmGroup> group;
+    if (n_ranks > 1){
+        group = std::make_unique<nn::ShmGroup>(group_name, rank, n_ranks, model.params.size() + 2);
+        // start from the parameters of rank 0
+        std::vector<fp_t> values;
+        for (auto p: model.params) values.push_back(p->value);
+        group->broadcast(values.data(), values.size());
+        for (std::size_t i = 0; i < values.size(); i++) model.params[i]->value = values[i];
+    }
+    nn::Batch batch = graph.batch(batch_size / n_ranks);
+
     const int total_iter = 8e4;
+    fp_t loss = 0;
     for (int i = 0; i < total_iter; i++){
-        train_step(model, i, total_iter);
+        if (!train_step(model, loader, batch, i, total_iter, group.get(), loss)) break;
     }
+    if (rank != 0) return 0;
+    while (wait(nullptr) > 0) {}
 
-    auto get_acc = [](Model& model)->float{
+    std::mt19937 eval_generator(std::random_device{}());
+    auto get_acc = [&eval_generator](Model& model)->float{
         float n_correct = 0;
         const int n_samples = 500;
-        for (auto [x, y, z] : get_samples<n_samples>()){
-            model.input_x.set_value(x);
-            model.input_y.set_value(y);
+        for (int i = 0; i < n_samples; i++){
+            fp_t sample[3];
+            get_sample(sample, eval_generator);
+            model.input_x.set_value(sample[0]);
+            model.input_y.set_value(sample[1]);
             model.graph->forward();
-            if ((model.prediciton.value() > 0.5) == (z > 0.5)){
+            if ((model.prediciton.value() > 0.5) == (sample[2] > 0.5)){
                 n_correct++;
             }
         }
         return n_correct / static_cast<float>(n_samples);
     };
 
-    std::cout << "final loss: " << model.loss.value() << ", acc: " << get_acc(model) << std::endl;
+    std::cout << "final loss: " << loss << ", acc: " << get_acc(model) << std::endl;
+    report_int8(model, eval_generator);
     save_bitmap(model);
     return 0;
 }
@@ -153,7 +221,6 @@ int main(){
 void save_bitmap(Model& model){
     const int w = 256;
     const int h = 256;
-    float res[w][h];
 
     auto norm_value = [](fp_t v){
         const fp_t ep = 0.5; const fp_t lb = -ep; const fp_t ub = 1 + ep;
@@ -161,24 +228,33 @@ void save_bitmap(Model& model){
         return (unsigned char)(v * 255);
     };
 
-    for (int i = 0; i < w; i++){
-        for (int j = 0; j < h; j++){
-            model.input_x.set_value(i * 10.0 / w - 5);
-            model.input_y.set_value(j * 10.0 / h - 5);
-            model.graph->forward();
-            auto pred = model.prediciton.value();
-            res[i][j] = norm_value(pred);
+    // rows are predicted in bands, so that memory stays O(w) at any resolution
+    const int band = 64;
+    std::vector<fp_t> grid(w * band * 2), pred(w * band);
+    write_bitmap("mlp_prediction.bmp", w, h, BitmapFormat::Gray8, [&](int j, unsigned char* pixels){
+        const int j0 = j - j % band;
+        if (j == j0){
+            const int n_rows = std::min(band, h - j0);
+            for (int r = 0; r < n_rows; r++){
+                for (int i = 0; i < w; i++){
+                    grid[(r * w + i) * 2] = i * 10.0 / w - 5;
+                    grid[(r * w + i) * 2 + 1] = (j0 + r) * 10.0 / h - 5;
+                }
+            }
+            model.graph->predict(
+                {model.input_x.ptr, model.input_y.ptr}, grid.data(), n_rows * w,
+                {model.prediciton.ptr}, pred.data()
+                );
         }
-    }
-    write_bitmap<w, h>("mlp_prediction.bmp", res);
+        for (int i = 0; i < w; i++) pixels[i] = norm_value(pred[(j - j0) * w + i]);
+    });
 
-    for (int i = 0; i < w; i++){
-        for (int j = 0; j < h; j++){
+    write_bitmap("mlp_aim.bmp", w, h, BitmapFormat::Gray8, [&](int j, unsigned char* pixels){
+        for (int i = 0; i < w; i++){
             auto z = static_cast<fp_t>(
                 aim_levelset(i * 10.0 / w - 5, j * 10.0 / h - 5) < 0
                 );
-            res[i][j] = norm_value(z);
+            pixels[i] = norm_value(z);
         }
-    }
-    write_bitmap<w, h>("mlp_aim.bmp", res);
-}
\ No newline at end of file
+    });
+}
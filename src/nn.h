@@ -2,6 +2,8 @@
 #include <string>
 #include <vector>
 #include <cassert>
+#include <algorithm>
+#include <functional>
 
 namespace nn {
 
@@ -10,6 +12,13 @@ typedef double fp_t;
 struct Node;
 struct Graph;
 struct NodeProxy;
+struct Batch;
+
+// Accuracy of the transcendental kernels used when ops run over many values
+enum class MathMode {
+    Exact,      // libm, bit-identical to the scalar path
+    Fast,       // vectorizable polynomial approximations, within a few ULP
+};
 
 struct OpNode {
     std::string name = "Op";
@@ -17,6 +26,8 @@ struct OpNode {
     Node *output = nullptr;
     virtual void forward() = 0;                     // update output->value
     virtual void backward(fp_t grad) = 0;           // update inputs[.]->grad
+    virtual void forward(Batch& batch) = 0;         // update batch.value(output)
+    virtual void backward(Batch& batch) = 0;        // update batch.grad(inputs[.]) from batch.grad(output)
     virtual ~OpNode() {}
 };
 
@@ -25,6 +36,8 @@ struct OpNode {
         Op##OP() { name = #OP; } \
         void forward() override; \
         void backward(fp_t grad) override; \
+        void forward(Batch& batch) override; \
+        void backward(Batch& batch) override; \
     };
 
 DECLARE_OP(Add)
@@ -42,17 +55,49 @@ DECLARE_OP(Cos)
 DECLARE_OP(Relu)
 DECLARE_OP(Sigmoid)
 DECLARE_OP(Tanh)
+DECLARE_OP(Exp)
+DECLARE_OP(LogSumExp)               // log(sum_i exp(inputs[i]))
+DECLARE_OP(SoftmaxCrossEntropy)     // inputs: K logits, then K targets
 
 struct Graph {
 
     ~Graph();
     std::vector<Node*> nodes;
     std::vector<OpNode*> ops;
+    MathMode math_mode = MathMode::Exact;
     void forward();
     void backward(Node* node, fp_t grad = 1);
     inline void backward(NodeProxy node_proxy, fp_t grad = 1);
+    // adds weights[k] (default 1) to roots[k]->grad and sweeps once: the gradients
+    // of sum_k weights[k] * roots[k], without building the sum
+    void backward(const std::vector<Node*>& roots, const std::vector<fp_t>& weights = {});
     void clear_grad();
 
+    // batched execution, every lane starts from the current node values
+    Batch batch(size_t size, bool with_grad = true);
+    void forward(Batch& batch);
+    void backward(Batch& batch, Node* node, fp_t grad = 1);
+    void backward(Batch& batch, const std::vector<Node*>& roots, const std::vector<fp_t>& weights = {});
+    // reverse sweep from the gradient lanes already set in the batch
+    void backward(Batch& batch);
+
+    // Row-major [outputs.size()][wrt.size()] Jacobian at the current node values
+    // (call forward() first), in one reverse sweep: lane k of a Batch carries the
+    // adjoints of outputs[k]
+    std::vector<fp_t> jacobian(const std::vector<Node*>& outputs, const std::vector<Node*>& wrt);
+
+    // Evaluates `outputs` for n rows of input values, input_values is row-major
+    // [n][inputs.size()] and output_values [n][outputs.size()]. Rows are split into
+    // tiles of `tile` lanes that run on n_threads threads (0: one per core), each
+    // with its own Batch holding lanes only for the inputs and the nodes the
+    // outputs depend on, only reading the graph. Node values are left unchanged,
+    // with MathMode::Exact the results are identical to setting each row and calling forward().
+    void predict(
+        const std::vector<Node*>& inputs, const fp_t* input_values, size_t n,
+        const std::vector<Node*>& outputs, fp_t* output_values,
+        size_t n_threads = 0, size_t tile = 256
+    );
+
     NodeProxy variable(fp_t value = 0, std::string name = "");
     NodeProxy constant(fp_t value = 0, std::string name = "");
 
@@ -74,7 +119,32 @@ struct Graph {
     Node* relu(Node* a);
     Node* sigmoid(Node* a);
     Node* tanh(Node* a);
-
+    Node* exp(Node* a);
+
+    // Over a group of nodes, O(K) nodes and work for K inputs. The log-sum-exp
+    // is evaluated in one pass with a running maximum, so large inputs never overflow.
+    Node* logsumexp(const std::vector<Node*>& x);
+    std::vector<Node*> log_softmax(const std::vector<Node*>& x);     // x_i - logsumexp(x)
+    std::vector<Node*> softmax(const std::vector<Node*>& x);         // exp(log_softmax(x)_i)
+    // sum_i -targets[i] * log_softmax(logits)_i as a single node, its gradient
+    // is p - targets for p = softmax(logits) and targets summing to 1
+    Node* softmax_cross_entropy(const std::vector<Node*>& logits, const std::vector<Node*>& targets);
+
+    // Moves the nodes and ops of `segment`, built separately (e.g. on another
+    // thread), to the end of this graph and renumbers them; `segment` is left
+    // empty. Its ops may take as inputs nodes already in this graph, so the
+    // graph order stays topological. O(segment size), no node is copied.
+    void splice(Graph& segment);
+    // Runs build(segment, i) for i < n on n_threads threads (0: one per core),
+    // each into its own segment, which may read but not modify this graph; the
+    // segments are then spliced in order of i, so the nodes and their order do
+    // not depend on the scheduling (randomly initialized values, e.g. by
+    // normal_init, do). Layers built in a segment must be finished in build().
+    // If build throws, the other threads stop after their current segment, this
+    // graph is left unchanged and the first exception (by thread) is rethrown.
+    void build_parallel(size_t n, const std::function<void(Graph& segment, size_t i)>& build, size_t n_threads = 0);
+
+    // whole graph as one DOT string, see nn_export.h to stream large graphs
     std::string to_graphviz();
 
 private:
@@ -86,6 +156,7 @@ struct Node {
     fp_t value;
     fp_t grad = 0;
     Graph* graph = nullptr;
+    size_t id = 0;                  // index in graph->nodes
     OpNode* op = nullptr;
     std::string name = "";
     bool requires_grad = true;
@@ -98,6 +169,29 @@ private:
     Node& operator=(const Node&& b) = delete;
 };
 
+// Node values and gradients for `size` independent evaluations (lanes) of a graph.
+// Storage is node-major, the lanes of one node are contiguous.
+struct Batch {
+    size_t size = 0;
+    MathMode math_mode = MathMode::Exact;
+    std::vector<fp_t> values;
+    std::vector<fp_t> grads;
+    std::vector<fp_t> scratch;      // 3 * `size` lanes of temporary storage for op kernels
+    // node id -> row of lanes, for a batch holding only some of the nodes (the
+    // ops are then run directly, see Graph::predict); nullptr: row = id
+    const size_t* rows = nullptr;
+
+    size_t row(const Node* node) const { return rows != nullptr ? rows[node->id] : node->id; }
+    fp_t* value(const Node* node) { return values.data() + row(node) * size; }
+    fp_t* grad(const Node* node) { return grads.data() + row(node) * size; }
+    void clear_grad() { std::fill(grads.begin(), grads.end(), 0); }
+    void fill(const Node* node, fp_t v) { std::fill_n(value(node), size, v); }
+    // sum over the first n lanes; pass the sample count when the lanes after it
+    // are padding (see Minibatch::load)
+    fp_t grad_sum(const Node* node, size_t n) { fp_t s = 0; for (size_t i = 0; i < n; i++) s += grad(node)[i]; return s; }
+    fp_t grad_sum(const Node* node) { return grad_sum(node, size); }
+};
+
 
 // For handy usage of: 
 // 1. operator overloading
@@ -137,6 +231,7 @@ struct NodeProxy{
     NodeProxy abs() { return NodeProxy(graph().abs(ptr)); }
     NodeProxy sin() { return NodeProxy(graph().sin(ptr)); }
     NodeProxy cos() { return NodeProxy(graph().cos(ptr)); }
+    NodeProxy exp() { return NodeProxy(graph().exp(ptr)); }
 
     NodeProxy relu() { return NodeProxy(graph().relu(ptr)); }
     NodeProxy sigmoid() { return NodeProxy(graph().sigmoid(ptr)); }
@@ -10,6 +10,7 @@ enum class ActivationType {
     Relu,
     Sigmoid,
     Tanh,
+    Softmax,    // over all the nodes of the layer
 };
 
 template <size_t N>
@@ -25,6 +26,11 @@ ActivationLayer<N> activation_layer(
     ActivationType type
 ){
     auto layer = ActivationLayer<N>();
+    if (type == ActivationType::Softmax) {
+        auto p = graph.softmax(std::vector<Node*>(input, input + N));
+        std::copy_n(p.begin(), N, layer.output);
+        return layer;
+    }
     for (size_t i = 0; i < N; i++) {
         switch (type) {
             case ActivationType::Relu: layer.output[i] = graph.relu(input[i]); break;
@@ -57,8 +63,8 @@ struct LinearLayer {
     }
 
     LinearLayer normal_init(fp_t mean = true, fp_t sigma = 1) {
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
+        // one generator per thread, layers may be built concurrently (Graph::build_parallel)
+        thread_local std::mt19937 gen(std::random_device{}());
         std::normal_distribution<fp_t> dist(mean, sigma);
 
         for (auto &w : weight) {
@@ -77,6 +83,13 @@ struct LinearLayer {
     ActivationLayer<N_out> operator << (ActivationType t) {
         return activation_layer<N_out>(*graph, output, t);
     }
+
+    // the outputs are logits: the loss node of a N_out-class classifier with
+    // one-hot (or probability) targets, in O(N_out) nodes
+    Node* softmax_cross_entropy(Node* target[N_out]) {
+        return graph->softmax_cross_entropy(
+            std::vector<Node*>(output, output + N_out), std::vector<Node*>(target, target + N_out));
+    }
 };
 
 template <size_t N_in, size_t N_out>
@@ -0,0 +1,267 @@
+#include "nn_data.h"
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nn {
+
+namespace {
+std::runtime_error io_error(std::string what, std::string path) {
+    return std::runtime_error(what + " '" + path + "': " + std::strerror(errno));
+}
+
+// spin briefly, then yield, then sleep: the waiting side of the ring never blocks on a lock
+void backoff(size_t& spins) {
+    spins++;
+    if (spins < 64) return;
+    if (spins < 256) { std::this_thread::yield(); return; }
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+}
+
+MmapSource::MmapSource(std::string path, size_t width, bool single_precision):
+    n_width(width), single_precision(single_precision) {
+    assert(width > 0);
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw io_error("cannot open", path);
+    struct stat st;
+    if (fstat(fd, &st) != 0) { close(fd); throw io_error("cannot stat", path); }
+    n_bytes = st.st_size;
+    size_t sample_bytes = width * (single_precision ? sizeof(float) : sizeof(double));
+    if (n_bytes % sample_bytes != 0) {
+        close(fd);
+        throw std::runtime_error("'" + path + "' is not a whole number of samples of width " + std::to_string(width));
+    }
+    n_samples = n_bytes / sample_bytes;
+    if (n_bytes > 0) {
+        data = mmap(nullptr, n_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) { data = nullptr; close(fd); throw io_error("cannot map", path); }
+        madvise(data, n_bytes, MADV_SEQUENTIAL);
+    }
+    close(fd);
+}
+MmapSource::~MmapSource() { if (data != nullptr) munmap(data, n_bytes); }
+
+bool MmapSource::next(fp_t* sample) {
+    if (pos >= n_samples) return false;
+    if (single_precision) {
+        const float* row = (const float*)data + pos * n_width;
+        for (size_t j = 0; j < n_width; j++) sample[j] = row[j];
+    } else {
+        const double* row = (const double*)data + pos * n_width;
+        for (size_t j = 0; j < n_width; j++) sample[j] = row[j];
+    }
+    pos++;
+    return true;
+}
+
+CsvSource::CsvSource(std::string path, bool skip_header): path(path), skip_header(skip_header), line(256) {
+    rewind();
+    // the width is the number of fields of the first sample
+    if (read_line()) {
+        std::vector<fp_t> sample(line.size());
+        n_width = parse_line(sample.data(), sample.size());
+    }
+    if (n_width == 0) throw std::runtime_error("no samples in '" + path + "'");
+    rewind();
+}
+CsvSource::~CsvSource() { if (file != nullptr) std::fclose(file); }
+
+void CsvSource::rewind() {
+    if (file == nullptr) {
+        file = std::fopen(path.c_str(), "r");
+        if (file == nullptr) throw io_error("cannot open", path);
+        std::setvbuf(file, nullptr, _IOFBF, 1 << 20);
+    } else {
+        std::rewind(file);
+    }
+    line_no = 0;
+    if (skip_header) read_line();
+}
+
+// reads the next non-empty line into `line`, false at the end of the file
+bool CsvSource::read_line() {
+    while (true) {
+        size_t len = 0;
+        while (true) {
+            if (std::fgets(line.data() + len, line.size() - len, file) == nullptr) break;
+            len += std::strlen(line.data() + len);
+            if (len > 0 && line[len - 1] == '\n') break;
+            line.resize(line.size() * 2);
+        }
+        if (len == 0) return false;
+        line_no++;
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) len--;
+        line[len] = '\0';
+        if (len > 0) return true;
+    }
+}
+
+size_t CsvSource::parse_line(fp_t* sample, size_t max_width) {
+    const char* p = line.data();
+    size_t n = 0;
+    while (true) {
+        if (n == max_width) {
+            throw std::runtime_error("'" + path + "' line " + std::to_string(line_no) + ": more than "
+                + std::to_string(max_width) + " values");
+        }
+        char* end;
+        fp_t v = std::strtod(p, &end);
+        if (end == p) {
+            throw std::runtime_error("'" + path + "' line " + std::to_string(line_no) + ": expected a number");
+        }
+        sample[n++] = v;
+        while (*end == ' ' || *end == '\t') end++;
+        if (*end == '\0') return n;
+        if (*end != ',') {
+            throw std::runtime_error("'" + path + "' line " + std::to_string(line_no) + ": expected ','");
+        }
+        p = end + 1;
+    }
+}
+
+bool CsvSource::next(fp_t* sample) {
+    if (!read_line()) return false;
+    size_t n = parse_line(sample, n_width);
+    if (n != n_width) {
+        throw std::runtime_error("'" + path + "' line " + std::to_string(line_no) + ": expected "
+            + std::to_string(n_width) + " values, got " + std::to_string(n));
+    }
+    return true;
+}
+
+bool GeneratorSource::next(fp_t* sample) {
+    if (epoch_size != 0 && count == epoch_size) return false;
+    generate(sample);
+    count++;
+    return true;
+}
+
+ShuffleSource::ShuffleSource(Source& source, size_t capacity, unsigned seed):
+    source(source), capacity(capacity), buffer(capacity * source.width()), gen(seed) {
+    assert(capacity > 0);
+}
+
+bool ShuffleSource::next(fp_t* sample) {
+    const size_t w = width();
+    while (!source_done && n_buffered < capacity) {
+        if (!source.next(&buffer[n_buffered * w])) { source_done = true; break; }
+        n_buffered++;
+    }
+    if (n_buffered == 0) return false;
+    size_t i = std::uniform_int_distribution<size_t>(0, n_buffered - 1)(gen);
+    std::copy_n(&buffer[i * w], w, sample);
+    // refill the slot from the source, or shrink the buffer once it is drained
+    if (source_done || !source.next(&buffer[i * w])) {
+        source_done = true;
+        n_buffered--;
+        std::copy_n(&buffer[n_buffered * w], w, &buffer[i * w]);
+    }
+    return true;
+}
+
+void ShuffleSource::rewind() {
+    source.rewind();
+    n_buffered = 0;
+    source_done = false;
+}
+
+void Minibatch::load(size_t i, const std::vector<Node*>& nodes) const {
+    assert(i < size && nodes.size() <= width);
+    for (size_t j = 0; j < nodes.size(); j++) { nodes[j]->value = at(i, j); }
+}
+
+void Minibatch::load(Batch& batch, const std::vector<Node*>& nodes) const {
+    assert(size > 0 && batch.size >= size && nodes.size() <= width);
+    for (size_t j = 0; j < nodes.size(); j++) {
+        fp_t* lanes = batch.value(nodes[j]);
+        std::copy_n(column(j), size, lanes);
+        std::fill(lanes + size, lanes + batch.size, at(size - 1, j));
+    }
+}
+
+DataLoader::DataLoader(Source& source, size_t batch_size, size_t epochs, size_t prefetch):
+    source(source), batch_size(batch_size), width(source.width()), epochs(epochs), n_slots(prefetch),
+    slots(prefetch * source.width() * batch_size), slot_sizes(prefetch) {
+    assert(batch_size > 0 && prefetch > 0);
+    producer = std::thread(&DataLoader::produce, this);
+}
+
+DataLoader::~DataLoader() {
+    stopping.store(true, std::memory_order_relaxed);
+    producer.join();
+}
+
+void DataLoader::produce() {
+    // an exception must not leave the thread: hand it to the consumer
+    try {
+        produce_batches();
+    } catch (...) {
+        error = std::current_exception();
+    }
+    finished.store(true, std::memory_order_release);
+}
+
+void DataLoader::produce_batches() {
+    std::vector<fp_t> sample(width);
+    size_t epoch = 0;
+    bool more = true;
+    source.rewind();
+    while (more) {
+        // wait for a free slot
+        size_t slot = produced.load(std::memory_order_relaxed);
+        size_t spins = 0;
+        while (slot - consumed.load(std::memory_order_acquire) == n_slots) {
+            if (stopping.load(std::memory_order_relaxed)) return;
+            backoff(spins);
+        }
+        fp_t* data = &slots[(slot % n_slots) * width * batch_size];
+        size_t n = 0;
+        while (n < batch_size) {
+            if (!source.next(sample.data())) {
+                epoch++;
+                if (epochs != 0 && epoch == epochs) { more = false; break; }
+                source.rewind();
+                if (!source.next(sample.data())) { more = false; break; }   // empty source
+            }
+            for (size_t j = 0; j < width; j++) { data[j * batch_size + n] = sample[j]; }
+            n++;
+        }
+        if (stopping.load(std::memory_order_relaxed)) return;
+        if (n > 0) {
+            slot_sizes[slot % n_slots] = n;
+            produced.store(slot + 1, std::memory_order_release);
+        }
+    }
+}
+
+bool DataLoader::next(Minibatch& batch) {
+    size_t slot = consumed.load(std::memory_order_relaxed);
+    if (holding) {
+        consumed.store(++slot, std::memory_order_release);
+        holding = false;
+    }
+    size_t spins = 0;
+    while (produced.load(std::memory_order_acquire) == slot) {
+        // `finished` is stored after the last batch, so recheck `produced` once it is set
+        if (finished.load(std::memory_order_acquire) && produced.load(std::memory_order_acquire) == slot) {
+            if (error) std::rethrow_exception(error);
+            return false;
+        }
+        backoff(spins);
+    }
+    holding = true;
+    batch.size = slot_sizes[slot % n_slots];
+    batch.width = width;
+    batch.stride = batch_size;
+    batch.data = &slots[(slot % n_slots) * width * batch_size];
+    return true;
+}
+
+}
@@ -0,0 +1,153 @@
+/* Training data pipeline: sample sources, shuffling, batching and background prefetch */
+#pragma once
+#include "nn.h"
+#include <atomic>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace nn {
+
+// A stream of samples, each made of width() values
+struct Source {
+    virtual size_t width() const = 0;
+    virtual bool next(fp_t* sample) = 0;    // false at the end of an epoch
+    virtual void rewind() = 0;              // start the next epoch
+    virtual ~Source() {}
+};
+
+// Memory-mapped binary file of packed samples, `width` native-endian
+// doubles (or floats) per sample
+struct MmapSource: public Source {
+    MmapSource(std::string path, size_t width, bool single_precision = false);
+    ~MmapSource();
+    size_t width() const override { return n_width; }
+    bool next(fp_t* sample) override;
+    void rewind() override { pos = 0; }
+    size_t size() const { return n_samples; }
+
+private:
+    size_t n_width;
+    size_t n_samples = 0;
+    size_t pos = 0;
+    bool single_precision;
+    void* data = nullptr;
+    size_t n_bytes = 0;
+    MmapSource(const MmapSource&) = delete;
+    MmapSource& operator=(const MmapSource&) = delete;
+};
+
+// Text file with one sample per line, values separated by commas.
+// The width is taken from the first sample, shorter or longer lines are errors.
+struct CsvSource: public Source {
+    CsvSource(std::string path, bool skip_header = false);
+    ~CsvSource();
+    size_t width() const override { return n_width; }
+    bool next(fp_t* sample) override;
+    void rewind() override;
+
+private:
+    std::string path;
+    bool skip_header;
+    size_t n_width = 0;
+    size_t line_no = 0;
+    std::FILE* file = nullptr;
+    std::vector<char> line;
+    bool read_line();
+    size_t parse_line(fp_t* sample, size_t max_width);
+    CsvSource(const CsvSource&) = delete;
+    CsvSource& operator=(const CsvSource&) = delete;
+};
+
+// Samples computed by a callback, `epoch_size` per epoch (0 for an endless stream)
+struct GeneratorSource: public Source {
+    GeneratorSource(size_t width, std::function<void(fp_t*)> generate, size_t epoch_size = 0):
+        n_width(width), generate(generate), epoch_size(epoch_size) {}
+    size_t width() const override { return n_width; }
+    bool next(fp_t* sample) override;
+    void rewind() override { count = 0; }
+
+private:
+    size_t n_width;
+    std::function<void(fp_t*)> generate;
+    size_t epoch_size;
+    size_t count = 0;
+};
+
+// Shuffles another source through a buffer of at most `capacity` samples:
+// each output is drawn at random from the buffer and replaced by the next input
+struct ShuffleSource: public Source {
+    ShuffleSource(Source& source, size_t capacity, unsigned seed = std::random_device()());
+    size_t width() const override { return source.width(); }
+    bool next(fp_t* sample) override;
+    void rewind() override;
+
+private:
+    Source& source;
+    size_t capacity;
+    size_t n_buffered = 0;
+    bool source_done = false;
+    std::vector<fp_t> buffer;
+    std::mt19937 gen;
+};
+
+// A batch of samples, stored column-major: column j holds value j of every
+// sample, so that a column can be copied into the lanes of a node at once
+struct Minibatch {
+    size_t size = 0;
+    size_t width = 0;
+    size_t stride = 0;
+    const fp_t* data = nullptr;
+
+    const fp_t* column(size_t j) const { return data + j * stride; }
+    fp_t at(size_t i, size_t j) const { return data[j * stride + i]; }
+    // nodes[j]->value = value j of sample i
+    void load(size_t i, const std::vector<Node*>& nodes) const;
+    // lanes of nodes[j] = column j, for batch.size >= size: on a short last
+    // batch the lanes from `size` on repeat the last sample, so their gradients
+    // must be left out with batch.grad_sum(node, size)
+    void load(Batch& batch, const std::vector<Node*>& nodes) const;
+};
+
+// Groups samples into batches on a background thread. Batches go through a
+// lock-free single-producer single-consumer ring of `prefetch` slots (double
+// buffering by default), so the training thread only waits when the
+// producer falls behind. Epochs are concatenated, only the last batch of the
+// last epoch may be smaller than batch_size (epochs = 0 runs forever).
+// The source is rewound when the loader starts and is owned by the
+// producer thread until the loader is destroyed.
+struct DataLoader {
+    DataLoader(Source& source, size_t batch_size, size_t epochs = 0, size_t prefetch = 2);
+    ~DataLoader();
+
+    // Next batch, valid until the following call. Returns false once the data
+    // is exhausted, rethrows an exception thrown by the source (e.g. a malformed
+    // CSV line) after the batches completed before it.
+    bool next(Minibatch& batch);
+
+private:
+    Source& source;
+    size_t batch_size;
+    size_t width;
+    size_t epochs;
+    size_t n_slots;
+    std::vector<fp_t> slots;                // n_slots * width * batch_size
+    std::vector<size_t> slot_sizes;
+    std::atomic<size_t> produced{0};
+    std::atomic<size_t> consumed{0};
+    std::atomic<bool> finished{false};
+    std::atomic<bool> stopping{false};
+    std::exception_ptr error;               // thrown by the source, set before `finished`
+    bool holding = false;                   // the consumer still reads the slot at `consumed`
+    std::thread producer;
+    void produce();
+    void produce_batches();
+    DataLoader(const DataLoader&) = delete;
+    DataLoader& operator=(const DataLoader&) = delete;
+};
+
+}
@@ -0,0 +1,396 @@
+#include "nn_export.h"
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <unistd.h>
+
+namespace nn {
+
+namespace {
+
+// Formats into a fixed buffer that is flushed to a stream or file descriptor
+struct Writer {
+    std::ostream* out = nullptr;
+    int fd = -1;
+    bool ok = true;
+    size_t len = 0;
+    char buf[1 << 16];
+
+    Writer(std::ostream& out): out(&out) {}
+    Writer(int fd): fd(fd) {}
+
+    void flush() {
+        if (len == 0 || !ok) { len = 0; return; }
+        if (out != nullptr) {
+            out->write(buf, len);
+            ok = bool(*out);
+        } else {
+            for (size_t done = 0; done < len; ) {
+                ssize_t n = ::write(fd, buf + done, len - done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) { ok = false; break; }
+                done += n;
+            }
+        }
+        len = 0;
+    }
+    char* reserve(size_t n) {
+        if (len + n > sizeof(buf)) flush();
+        return buf + len;
+    }
+    Writer& put(const char* s, size_t n) {
+        while (n > 0) {
+            if (len == sizeof(buf)) flush();
+            size_t k = std::min(n, sizeof(buf) - len);
+            std::memcpy(buf + len, s, k);
+            len += k; s += k; n -= k;
+        }
+        return *this;
+    }
+    Writer& operator<<(const char* s) { return put(s, std::strlen(s)); }
+    Writer& operator<<(const std::string& s) { return put(s.data(), s.size()); }
+    Writer& operator<<(size_t v) {
+        len += std::snprintf(reserve(24), 24, "%zu", v);
+        return *this;
+    }
+    Writer& format(const char* fmt, fp_t v) {
+        len += std::snprintf(reserve(32), 32, fmt, v);
+        return *this;
+    }
+    // string contents for a JSON string
+    Writer& escaped(const std::string& s) {
+        for (char c: s) {
+            if (c == '"' || c == '\\') { char e[2] = {'\\', c}; put(e, 2); }
+            else if ((unsigned char)c < 0x20) { len += std::snprintf(reserve(8), 8, "\\u%04x", c); }
+            else put(&c, 1);
+        }
+        return *this;
+    }
+    // string contents for a quoted DOT label: Graphviz has no \u escapes, so
+    // newlines become \n line breaks and other control characters are dropped
+    Writer& dot_escaped(const std::string& s) {
+        for (char c: s) {
+            if (c == '"' || c == '\\') { char e[2] = {'\\', c}; put(e, 2); }
+            else if (c == '\n') put("\\n", 2);
+            else if ((unsigned char)c >= 0x20) put(&c, 1);
+        }
+        return *this;
+    }
+};
+
+// the nodes to export and the summary node each of them belongs to
+struct Selection {
+    std::vector<bool> selected;
+    std::vector<bool> truncated;        // selected, but its inputs are not
+    std::vector<size_t> group;          // representative node id, group[id] == id if not merged
+    std::vector<size_t> group_size;     // by representative
+    std::vector<std::string> group_name;
+    bool collapsed = false;
+
+    size_t find(size_t id) {
+        while (group[id] != id) { group[id] = group[group[id]]; id = group[id]; }
+        return id;
+    }
+    void merge(size_t a, size_t b) {
+        a = find(a); b = find(b);
+        if (a != b) group[std::min(a, b)] = std::max(a, b);     // the later node represents the group
+    }
+};
+
+Selection select(const Graph& graph, const ExportOptions& options) {
+    const auto& nodes = graph.nodes;
+    Selection s;
+    s.selected.assign(nodes.size(), options.root == nullptr);
+    s.truncated.assign(nodes.size(), false);
+    if (options.root != nullptr) {
+        // inputs always precede their op in graph order, so one backward pass gives depths
+        assert(options.root->graph == &graph);
+        std::vector<size_t> depth(nodes.size(), SIZE_MAX);
+        depth[options.root->id] = 0;
+        for (size_t id = options.root->id + 1; id-- > 0; ) {
+            if (depth[id] == SIZE_MAX) continue;
+            s.selected[id] = true;
+            OpNode* op = nodes[id]->op;
+            if (op == nullptr) continue;
+            if (depth[id] >= options.max_depth) { s.truncated[id] = true; continue; }
+            for (Node* input: op->inputs) { depth[input->id] = std::min(depth[input->id], depth[id] + 1); }
+        }
+    }
+
+    s.group.resize(nodes.size());
+    for (size_t id = 0; id < nodes.size(); id++) s.group[id] = id;
+    auto exported_op = [&](size_t id) { return s.selected[id] && !s.truncated[id] && nodes[id]->op != nullptr; };
+
+    // A layer is its named nodes plus every node between two of them (reachable
+    // from the layer and reaching it), e.g. the products and sums of a linear
+    // layer, so that the summary node has no edge back to itself. A layer whose
+    // closure would take in nodes of another layer is left expanded.
+    std::vector<std::string> layers;
+    if (options.layer) {
+        const size_t none = SIZE_MAX;
+        std::vector<std::string> named(nodes.size());
+        std::unordered_map<std::string, std::vector<size_t>> members;
+        std::vector<std::string> order;
+        for (size_t id = 0; id < nodes.size(); id++) {
+            if (!s.selected[id]) continue;
+            named[id] = options.layer(nodes[id]);
+            if (named[id].empty()) continue;
+            auto& m = members[named[id]];
+            if (m.empty()) order.push_back(named[id]);
+            m.push_back(id);
+        }
+        layers.resize(nodes.size());
+        std::vector<size_t> from(nodes.size(), none), to(nodes.size(), none);
+        for (size_t k = 0; k < order.size(); k++) {
+            const std::string& name = order[k];
+            const std::vector<size_t>& m = members[name];
+            const size_t lo = m.front(), hi = m.back();
+            // ids are a topological order: paths between the members stay in [lo, hi]
+            for (size_t id = lo; id <= hi; id++) {
+                if (named[id] == name) { from[id] = k; continue; }
+                if (!exported_op(id)) continue;
+                for (Node* input: nodes[id]->op->inputs) {
+                    if (from[input->id] == k) { from[id] = k; break; }
+                }
+            }
+            for (size_t id = hi + 1; id-- > lo; ) {
+                if (named[id] == name) to[id] = k;
+                if (to[id] != k || !exported_op(id)) continue;
+                for (Node* input: nodes[id]->op->inputs) { to[input->id] = k; }
+            }
+            std::vector<size_t> between;
+            bool conflict = false;
+            for (size_t id = lo; id <= hi && !conflict; id++) {
+                if (named[id] == name || from[id] != k || to[id] != k) continue;
+                conflict = !named[id].empty() || !layers[id].empty();
+                between.push_back(id);
+            }
+            if (conflict || m.size() + between.size() < 2) continue;
+            for (size_t id: m) { layers[id] = name; s.merge(m.front(), id); }
+            for (size_t id: between) { layers[id] = name; s.merge(m.front(), id); }
+            s.collapsed = true;
+        }
+    }
+    // runs of the same op, not across a layer boundary
+    if (options.collapse_op_runs) {
+        std::vector<unsigned> consumers(nodes.size(), 0);
+        for (size_t id = 0; id < nodes.size(); id++) {
+            if (!exported_op(id)) continue;
+            for (Node* input: nodes[id]->op->inputs) { consumers[input->id]++; }
+        }
+        for (size_t id = 0; id < nodes.size(); id++) {
+            if (!exported_op(id)) continue;
+            for (Node* input: nodes[id]->op->inputs) {
+                if (input->op == nullptr || consumers[input->id] != 1) continue;
+                if (input->op->name != nodes[id]->op->name) continue;
+                if (!layers.empty() && layers[input->id] != layers[id]) continue;
+                s.merge(input->id, id);
+                s.collapsed = true;
+            }
+        }
+    }
+
+    if (s.collapsed) {
+        s.group_size.assign(nodes.size(), 0);
+        s.group_name.resize(nodes.size());
+        for (size_t id = 0; id < nodes.size(); id++) {
+            if (!s.selected[id]) continue;
+            size_t g = s.find(id);
+            s.group_size[g]++;
+            if (!layers.empty() && !layers[id].empty()) s.group_name[g] = layers[id];
+            else if (s.group_name[g].empty() && nodes[id]->op != nullptr) s.group_name[g] = nodes[id]->op->name;
+        }
+    }
+    return s;
+}
+
+// edges between summary nodes, without duplicates, by consuming group
+std::unordered_map<size_t, std::vector<size_t>> group_inputs(const Graph& graph, Selection& s) {
+    std::unordered_map<size_t, std::vector<size_t>> inputs;
+    std::unordered_set<uint64_t> seen;
+    for (size_t id = 0; id < graph.nodes.size(); id++) {
+        if (!s.selected[id] || s.truncated[id] || graph.nodes[id]->op == nullptr) continue;
+        size_t to = s.find(id);
+        for (Node* input: graph.nodes[id]->op->inputs) {
+            size_t from = s.find(input->id);
+            if (from == to || !seen.insert((uint64_t)from * graph.nodes.size() + to).second) continue;
+            inputs[to].push_back(from);
+        }
+    }
+    return inputs;
+}
+
+// Summary nodes in a topological order of the collapsed graph, in graph order
+// where there is a choice. The representative of a group is its last node,
+// which may come after a node that consumes another of the group's nodes.
+std::vector<size_t> group_order(
+    const Graph& graph, Selection& s, const std::unordered_map<size_t, std::vector<size_t>>& inputs
+) {
+    std::unordered_map<size_t, std::vector<size_t>> consumers;
+    std::unordered_map<size_t, size_t> pending;
+    for (auto& [to, from]: inputs) {
+        pending[to] = from.size();
+        for (size_t f: from) { consumers[f].push_back(to); }
+    }
+    std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t>> ready;
+    for (size_t id = 0; id < graph.nodes.size(); id++) {
+        if (s.selected[id] && s.find(id) == id && pending.count(id) == 0) ready.push(id);
+    }
+    std::vector<size_t> order;
+    while (!ready.empty()) {
+        size_t id = ready.top();
+        ready.pop();
+        order.push_back(id);
+        auto it = consumers.find(id);
+        if (it == consumers.end()) continue;
+        for (size_t to: it->second) {
+            if (--pending[to] == 0) ready.push(to);
+        }
+    }
+    return order;
+}
+
+// same rules as the labels of the original to_graphviz
+void write_value(Writer& w, fp_t v) {
+    if (std::abs(v) < 1e-3 || std::abs(v) > 1e3) w.format("%.3e", v);
+    else w.format("%.2f", v);
+}
+
+void write_dot_label(Writer& w, Node* node, bool truncated, const ExportOptions& options) {
+    if (node->op != nullptr) w << node->op->name << ": ";
+    if (node->name != "") w.dot_escaped(node->name) << (options.values ? "@" : "");
+    if (options.values) {
+        write_value(w, node->value);
+        if (node->requires_grad && node->grad != 0) { w << ", ∂="; write_value(w, node->grad); }
+    }
+    if (!node->requires_grad) w << ", const";
+    if (truncated) w << ", ...";
+}
+
+bool write_graphviz(const Graph& graph, Writer& w, const ExportOptions& options) {
+    Selection s = select(graph, options);
+    w << "digraph G {\n";
+    w << "  node [ shape=box, fixedsize=false, color=black, fontcolor=black, fontsize=12, fillcolor=white, style=filled ];\n";
+    w << "  edge [ color=black ];\n";
+    w << "  rankdir=TB;\n";
+    w << "  nodesep=0.5;\n";
+
+    std::unordered_map<size_t, std::vector<size_t>> inputs;
+    std::vector<size_t> order;
+    if (s.collapsed) {
+        inputs = group_inputs(graph, s);
+        order = group_order(graph, s, inputs);
+    }
+    const size_t n = s.collapsed ? order.size() : graph.nodes.size();
+    for (size_t k = 0; k < n; k++) {
+        const size_t id = s.collapsed ? order[k] : k;
+        if (!s.selected[id] || s.find(id) != id) continue;
+        Node* node = graph.nodes[id];
+        w << "  n" << id << " [label=\"";
+        if (s.collapsed && s.group_size[id] > 1) {
+            w.dot_escaped(s.group_name[id]) << " ×" << s.group_size[id] << "\", fillcolor=lightgrey];\n";
+            continue;
+        }
+        write_dot_label(w, node, s.truncated[id], options);
+        w << (node->op != nullptr ? "\", color=blue];\n" : "\"];\n");
+    }
+
+    if (s.collapsed) {
+        for (size_t to: order) {
+            auto it = inputs.find(to);
+            if (it == inputs.end()) continue;
+            for (size_t from: it->second) { w << "  n" << from << " -> n" << to << ";\n"; }
+        }
+    } else {
+        for (size_t id = 0; id < graph.nodes.size(); id++) {
+            if (!s.selected[id] || s.truncated[id] || graph.nodes[id]->op == nullptr) continue;
+            for (Node* input: graph.nodes[id]->op->inputs) { w << "  n" << input->id << " -> n" << id << ";\n"; }
+        }
+    }
+    w << "}\n";
+    w.flush();
+    return w.ok;
+}
+
+void write_json_number(Writer& w, fp_t v) {
+    if (std::isfinite(v)) w.format("%.17g", v);
+    else w << "null";
+}
+
+bool write_jsonl(const Graph& graph, Writer& w, const ExportOptions& options) {
+    Selection s = select(graph, options);
+    std::unordered_map<size_t, std::vector<size_t>> inputs;
+    std::vector<size_t> order;
+    if (s.collapsed) {
+        inputs = group_inputs(graph, s);
+        order = group_order(graph, s, inputs);
+    }
+
+    const size_t n = s.collapsed ? order.size() : graph.nodes.size();
+    for (size_t k = 0; k < n; k++) {
+        const size_t id = s.collapsed ? order[k] : k;
+        if (!s.selected[id] || s.find(id) != id) continue;
+        Node* node = graph.nodes[id];
+        w << "{\"id\":" << id;
+        if (s.collapsed && s.group_size[id] > 1) {
+            w << ",\"group\":\""; w.escaped(s.group_name[id]) << "\",\"size\":" << s.group_size[id];
+        } else {
+            w << ",\"op\":";
+            if (node->op != nullptr) w << "\"" << node->op->name << "\"";
+            else w << "null";
+            w << ",\"name\":\""; w.escaped(node->name) << "\"";
+            if (options.values) {
+                w << ",\"value\":"; write_json_number(w, node->value);
+                w << ",\"grad\":"; write_json_number(w, node->grad);
+            }
+            w << ",\"const\":" << (node->requires_grad ? "false" : "true");
+            if (s.truncated[id]) w << ",\"truncated\":true";
+        }
+        w << ",\"inputs\":[";
+        if (s.collapsed) {
+            auto it = inputs.find(id);
+            if (it != inputs.end()) {
+                for (size_t i = 0; i < it->second.size(); i++) { w << (i ? "," : "") << it->second[i]; }
+            }
+        } else if (node->op != nullptr && !s.truncated[id]) {
+            for (size_t i = 0; i < node->op->inputs.size(); i++) { w << (i ? "," : "") << node->op->inputs[i]->id; }
+        }
+        w << "]}\n";
+    }
+    w.flush();
+    return w.ok;
+}
+
+}
+
+bool write_graphviz(const Graph& graph, std::ostream& out, const ExportOptions& options) {
+    Writer w(out);
+    return write_graphviz(graph, w, options);
+}
+bool write_graphviz(const Graph& graph, int fd, const ExportOptions& options) {
+    Writer w(fd);
+    return write_graphviz(graph, w, options);
+}
+bool write_jsonl(const Graph& graph, std::ostream& out, const ExportOptions& options) {
+    Writer w(out);
+    return write_jsonl(graph, w, options);
+}
+bool write_jsonl(const Graph& graph, int fd, const ExportOptions& options) {
+    Writer w(fd);
+    return write_jsonl(graph, w, options);
+}
+
+std::function<std::string(const Node*)> layer_by_name(std::vector<std::string> separators) {
+    return [separators](const Node* node) {
+        size_t end = std::string::npos;
+        for (auto& sep: separators) { end = std::min(end, node->name.find(sep)); }
+        return end == std::string::npos ? std::string() : node->name.substr(0, end);
+    };
+}
+
+}
@@ -0,0 +1,45 @@
+/* Streaming graph export: Graphviz DOT for viewing, JSON lines for tooling */
+#pragma once
+#include "nn.h"
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace nn {
+
+struct ExportOptions {
+    // only export `root` and the nodes it depends on, up to `max_depth` ops away
+    Node* root = nullptr;
+    size_t max_depth = SIZE_MAX;
+    // merge chains of ops of the same type (each feeding only the next one,
+    // e.g. the add chains of a linear layer) into one summary node
+    bool collapse_op_runs = false;
+    // merge all nodes mapped to the same non-empty layer name, and the nodes
+    // between them (e.g. the products and sums of a linear layer), into one
+    // summary node; a layer that would then take in another one is not merged
+    std::function<std::string(const Node*)> layer = nullptr;
+    // include values and gradients
+    bool values = true;
+};
+
+// Nodes are written in a topological order (graph order, unless summary nodes
+// require otherwise: a node's inputs always come first) through a
+// fixed-size buffer; the graph is never formatted into one string.
+// Return false if writing failed.
+bool write_graphviz(const Graph& graph, std::ostream& out, const ExportOptions& options = ExportOptions());
+bool write_graphviz(const Graph& graph, int fd, const ExportOptions& options = ExportOptions());
+
+// One JSON object per line and node:
+//   {"id":4,"op":"Add","name":"","value":1.5,"grad":0,"const":false,"inputs":[2,3]}
+// leaves have "op":null, nodes cut off by max_depth get "truncated":true, and
+// summary nodes are {"id":..,"group":"Add","size":15,"inputs":[..]}
+bool write_jsonl(const Graph& graph, std::ostream& out, const ExportOptions& options = ExportOptions());
+bool write_jsonl(const Graph& graph, int fd, const ExportOptions& options = ExportOptions());
+
+// Layer name = node name up to the first of `separators`, e.g. "linear_anon"
+// for "linear_anon_weight_0_1" with {"_weight", "_output"}; empty if none matches
+std::function<std::string(const Node*)> layer_by_name(std::vector<std::string> separators);
+
+}
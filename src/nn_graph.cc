@@ -1,9 +1,12 @@
 #include "nn.h"
+#include "nn_export.h"
 #include <iostream>
 #include <cassert>
 #include <sstream>
 #include <string>
-#include <iomanip>
+#include <atomic>
+#include <exception>
+#include <thread>
 
 namespace nn {
 
@@ -20,6 +23,7 @@ NodeProxy Graph::constant(fp_t value, std::string name) {
 // create a new leaf node
 Node* Graph::create_var(fp_t value, std::string name) {
     Node* node = new Node(this, name, value);
+    node->id = nodes.size();
     nodes.push_back(node);
     return node;
 }
@@ -35,6 +39,7 @@ Node* Graph::create_const(fp_t value, std::string name) {
     node->op = op; \
     op->inputs = {__VA_ARGS__}; \
     op->output = node; \
+    node->id = nodes.size(); \
     ops.push_back(op); \
     nodes.push_back(node); \
     return node; \
@@ -54,17 +59,89 @@ Node* Graph::sigmoid(Node* a) { IMPL_GRAPH_OP(Sigmoid, a) }
 Node* Graph::tanh(Node* a) { IMPL_GRAPH_OP(Tanh, a) }
 Node* Graph::sin(Node* a) { IMPL_GRAPH_OP(Sin, a) }
 Node* Graph::cos(Node* a) { IMPL_GRAPH_OP(Cos, a) }
+Node* Graph::exp(Node* a) { IMPL_GRAPH_OP(Exp, a) }
+
+Node* Graph::logsumexp(const std::vector<Node*>& x) {
+    assert(!x.empty());
+    IMPL_GRAPH_OP(LogSumExp, x)
+}
+std::vector<Node*> Graph::log_softmax(const std::vector<Node*>& x) {
+    Node* lse = logsumexp(x);
+    std::vector<Node*> y;
+    for (Node* xi: x) { y.push_back(sub(xi, lse)); }
+    return y;
+}
+std::vector<Node*> Graph::softmax(const std::vector<Node*>& x) {
+    std::vector<Node*> y = log_softmax(x);
+    for (Node*& yi: y) { yi = exp(yi); }
+    return y;
+}
+Node* Graph::softmax_cross_entropy(const std::vector<Node*>& logits, const std::vector<Node*>& targets) {
+    assert(!logits.empty() && logits.size() == targets.size());
+    std::vector<Node*> inputs = logits;
+    inputs.insert(inputs.end(), targets.begin(), targets.end());
+    IMPL_GRAPH_OP(SoftmaxCrossEntropy, inputs)
+}
 
 Graph::~Graph() {
     for (Node* node: nodes) { delete node; }
     for (OpNode* op: ops) { delete op; }
 }
 
+void Graph::splice(Graph& segment) {
+    assert(&segment != this);
+    const size_t offset = nodes.size();
+    for (OpNode* op: segment.ops) {
+        for (Node* input: op->inputs) { assert(input->graph == &segment || (input->graph == this && input->id < offset)); }
+    }
+    for (Node* node: segment.nodes) {
+        node->graph = this;
+        node->id += offset;
+    }
+    nodes.insert(nodes.end(), segment.nodes.begin(), segment.nodes.end());
+    ops.insert(ops.end(), segment.ops.begin(), segment.ops.end());
+    segment.nodes.clear();
+    segment.ops.clear();
+}
+
+void Graph::build_parallel(size_t n, const std::function<void(Graph& segment, size_t i)>& build, size_t n_threads) {
+    std::vector<Graph> segments(n);
+    if (n_threads == 0) n_threads = std::max(1u, std::thread::hardware_concurrency());
+    n_threads = std::min(n_threads, n);
+    std::atomic<size_t> next_segment{0};
+    std::vector<std::exception_ptr> errors(n_threads);
+
+    // an exception must not leave a thread: keep it and stop handing out segments
+    auto worker = [&](size_t w) {
+        try {
+            for (size_t i = next_segment++; i < n; i = next_segment++) { build(segments[i], i); }
+        } catch (...) {
+            errors[w] = std::current_exception();
+            next_segment = n;
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t w = 1; w < n_threads; w++) { threads.emplace_back(worker, w); }
+    if (n_threads > 0) worker(0);
+    for (auto& thread: threads) { thread.join(); }
+    for (auto& error: errors) {
+        if (error) std::rethrow_exception(error);
+    }
+
+    size_t n_nodes = nodes.size(), n_ops = ops.size();
+    for (Graph& segment: segments) {
+        n_nodes += segment.nodes.size();
+        n_ops += segment.ops.size();
+    }
+    nodes.reserve(n_nodes);
+    ops.reserve(n_ops);
+    for (Graph& segment: segments) { splice(segment); }
+}
+
 void Graph::clear_grad() { for (Node* node: nodes) { node->grad = 0; } }
 void Graph::forward() { for (OpNode* op: ops) { op->forward(); } }
-void Graph::backward(Node* node, fp_t grad) {
-    assert(node->graph == this);
-    node->grad = grad;
+namespace {
+void reverse_sweep(const std::vector<OpNode*>& ops) {
     for (int i = ops.size() - 1; i >= 0; i--) {
         assert(ops[i]->output != nullptr);
         auto root_grad = ops[i]->output->grad;
@@ -72,55 +149,154 @@ void Graph::backward(Node* node, fp_t grad) {
         ops[i]->backward(root_grad);
     }
 }
+}
+void Graph::backward(Node* node, fp_t grad) {
+    assert(node->graph == this);
+    node->grad = grad;
+    reverse_sweep(ops);
+}
+void Graph::backward(const std::vector<Node*>& roots, const std::vector<fp_t>& weights) {
+    assert(weights.empty() || weights.size() == roots.size());
+    for (size_t k = 0; k < roots.size(); k++) {
+        assert(roots[k]->graph == this);
+        roots[k]->grad += weights.empty() ? 1 : weights[k];
+    }
+    reverse_sweep(ops);
+}
 
+Batch Graph::batch(size_t size, bool with_grad) {
+    Batch batch;
+    batch.size = size;
+    batch.math_mode = math_mode;
+    batch.values.resize(nodes.size() * size);
+    if (with_grad) batch.grads.assign(nodes.size() * size, 0);
+    batch.scratch.resize(3 * size);
+    for (Node* node: nodes) { std::fill_n(batch.value(node), size, node->value); }
+    return batch;
+}
+void Graph::forward(Batch& batch) {
+    assert(batch.values.size() == nodes.size() * batch.size);
+    for (OpNode* op: ops) { op->forward(batch); }
+}
+void Graph::backward(Batch& batch, Node* node, fp_t grad) {
+    assert(node->graph == this);
+    assert(batch.grads.size() == nodes.size() * batch.size);
+    std::fill_n(batch.grad(node), batch.size, grad);
+    backward(batch);
+}
+void Graph::backward(Batch& batch, const std::vector<Node*>& roots, const std::vector<fp_t>& weights) {
+    assert(weights.empty() || weights.size() == roots.size());
+    assert(batch.grads.size() == nodes.size() * batch.size);
+    for (size_t k = 0; k < roots.size(); k++) {
+        assert(roots[k]->graph == this);
+        fp_t* g = batch.grad(roots[k]);
+        for (size_t i = 0; i < batch.size; i++) { g[i] += weights.empty() ? 1 : weights[k]; }
+    }
+    backward(batch);
+}
+void Graph::backward(Batch& batch) {
+    assert(batch.grads.size() == nodes.size() * batch.size);
+    for (int i = ops.size() - 1; i >= 0; i--) {
+        const fp_t* root_grad = batch.grad(ops[i]->output);
+        if (std::all_of(root_grad, root_grad + batch.size, [](fp_t g) { return g == 0; })) continue;
+        ops[i]->backward(batch);
+    }
+}
 
-std::string node_id(Node* node) { return std::to_string((size_t)node); }
-std::string node_id(OpNode* op) { return std::to_string((size_t)op); }
-std::string Graph::to_graphviz() {
-    std::string t = "digraph G {\n";
-    t += "  node [ shape=box, fixedsize=false, color=black, fontcolor=black, fontsize=12, fillcolor=white, style=filled ];\n";
-    t += "  edge [ color=black ];\n";
-    t += "  rankdir=TB;\n";
-    t += "  nodesep=0.5;\n";
-
-    auto drawOpNode = [&](OpNode* op) {
-        t += "  " + node_id(op) + " [label=\"" + op->name + "\", color=blue];\n";
-    };
-    auto drawNode = [&](Node* node) {
-        auto format_val = [](fp_t val) {
-            std::stringstream ss;
-            if (std::abs(val) < 1e-3) ss << std::scientific << std::setprecision(3) << val;
-            else if (std::abs(val) > 1e3) ss << std::scientific << std::setprecision(3) << val;
-            else ss << std::fixed << std::setprecision(2) << val;
-            return ss.str();
-        };
-        auto get_node_label = [&format_val](Node* node) {
-            std::string ret = "";
-            if (node->name != "") ret += node->name + "@";
-            ret = ret + format_val(node->value);
-            if (node->requires_grad && node->grad != 0) ret += ", ∂=" + format_val(node->grad);
-            if (!node->requires_grad) ret += ", const";
-            return ret;
-        };
-        t += "  " + node_id(node) + " [label=\"" + get_node_label(node) + "\"];\n";
-    };
-
-    for (Node* node: nodes) {
-        if (node->op != nullptr) continue;
-        drawNode(node);
+std::vector<fp_t> Graph::jacobian(const std::vector<Node*>& outputs, const std::vector<Node*>& wrt) {
+    std::vector<fp_t> J(outputs.size() * wrt.size(), 0);
+    if (outputs.empty()) return J;
+    Batch lanes = batch(outputs.size());
+    for (size_t k = 0; k < outputs.size(); k++) {
+        assert(outputs[k]->graph == this);
+        lanes.grad(outputs[k])[k] += 1;
+    }
+    backward(lanes);
+    for (size_t j = 0; j < wrt.size(); j++) {
+        assert(wrt[j]->graph == this);
+        const fp_t* g = lanes.grad(wrt[j]);
+        for (size_t k = 0; k < outputs.size(); k++) { J[k * wrt.size() + j] = g[k]; }
     }
-    for (OpNode* op: ops) { 
-        t += "subgraph cluster_" + node_id(op) + " {\n";
-        t += "  margin=5;\n  bgcolor=lightgrey;\n";
-        drawOpNode(op); 
-        drawNode(op->output);
-        t += "}\n";
+    return J;
+}
+
+
+void Graph::predict(
+    const std::vector<Node*>& inputs, const fp_t* input_values, size_t n,
+    const std::vector<Node*>& outputs, fp_t* output_values,
+    size_t n_threads, size_t tile
+) {
+    assert(tile > 0);
+    if (n == 0) return;
+    for (Node* node: inputs) { assert(node->graph == this && node->op == nullptr); }
+    for (Node* node: outputs) { assert(node->graph == this); }
+
+    // only the ops the outputs depend on
+    std::vector<bool> needed(nodes.size(), false);
+    for (Node* node: outputs) { needed[node->id] = true; }
+    std::vector<OpNode*> needed_ops;
+    for (int i = ops.size() - 1; i >= 0; i--) {
+        if (!needed[ops[i]->output->id]) continue;
+        needed_ops.push_back(ops[i]);
+        for (Node* input: ops[i]->inputs) { needed[input->id] = true; }
     }
+    std::reverse(needed_ops.begin(), needed_ops.end());
 
-    for (OpNode* op: ops) {
-        for (Node* input: op->inputs) { t += "  " + node_id(input) + " -> " + node_id(op) + ";\n"; }
-        t += "  " + node_id(op) + " -> " + node_id(op->output) + "[color=blue];\n";
+    // lanes only for the inputs and the nodes the needed ops read or write;
+    // the leaves among them hold the shared node values, filled once per thread
+    const size_t none = SIZE_MAX;
+    std::vector<size_t> rows(nodes.size(), none);
+    std::vector<Node*> leaves;
+    size_t n_rows = 0;
+    auto add_row = [&](Node* node) {
+        if (rows[node->id] != none) return;
+        rows[node->id] = n_rows++;
+        if (node->op == nullptr) leaves.push_back(node);
+    };
+    for (Node* node: inputs) { add_row(node); }
+    for (OpNode* op: needed_ops) {
+        for (Node* input: op->inputs) { add_row(input); }
+        add_row(op->output);
     }
-    return t + "}";
+    for (Node* node: outputs) { add_row(node); }
+
+    const size_t n_tiles = (n + tile - 1) / tile;
+    if (n_threads == 0) n_threads = std::max(1u, std::thread::hardware_concurrency());
+    n_threads = std::min(n_threads, n_tiles);
+    std::atomic<size_t> next_tile{0};
+
+    auto worker = [&]() {
+        Batch lanes;
+        lanes.size = tile;
+        lanes.math_mode = math_mode;
+        lanes.rows = rows.data();
+        lanes.values.resize(n_rows * tile);
+        lanes.scratch.resize(3 * tile);
+        for (Node* leaf: leaves) { lanes.fill(leaf, leaf->value); }
+        for (size_t t = next_tile++; t < n_tiles; t = next_tile++) {
+            const size_t begin = t * tile;
+            const size_t count = std::min(tile, n - begin);
+            for (size_t j = 0; j < inputs.size(); j++) {
+                fp_t* v = lanes.value(inputs[j]);
+                for (size_t i = 0; i < count; i++) { v[i] = input_values[(begin + i) * inputs.size() + j]; }
+            }
+            for (OpNode* op: needed_ops) { op->forward(lanes); }
+            for (size_t j = 0; j < outputs.size(); j++) {
+                const fp_t* v = lanes.value(outputs[j]);
+                for (size_t i = 0; i < count; i++) { output_values[(begin + i) * outputs.size() + j] = v[i]; }
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < n_threads; i++) { threads.emplace_back(worker); }
+    worker();
+    for (auto& thread: threads) { thread.join(); }
+}
+
+
+std::string Graph::to_graphviz() {
+    std::ostringstream out;
+    write_graphviz(*this, out);
+    return out.str();
 }
 }
\ No newline at end of file
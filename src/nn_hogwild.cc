@@ -0,0 +1,84 @@
+#include "nn_hogwild.h"
+#include <thread>
+
+namespace nn {
+
+ParameterStore::ParameterStore(std::vector<Node*> params):
+    params(params), values(new std::atomic<fp_t>[params.size()]) {
+    for (size_t i = 0; i < params.size(); i++) {
+        assert(params[i]->op == nullptr);
+        values[i].store(params[i]->value, std::memory_order_relaxed);
+    }
+}
+
+void ParameterStore::read(Batch& batch) const {
+    for (size_t i = 0; i < params.size(); i++) { batch.fill(params[i], get(i)); }
+}
+
+void ParameterStore::apply(size_t worker, Batch& batch, fp_t learning_rate, fp_t clip) {
+    // announcing the update and checking for a snapshot are one RMW on the
+    // slot: RMWs of one atomic are totally ordered, so either snapshot() sees
+    // the count or this sees PAUSED, without any sequentially consistent pair
+    std::atomic<size_t>& state = slots[worker % N_SLOTS].state;
+    while (state.fetch_add(2, std::memory_order_acquire) & PAUSED) {
+        state.fetch_sub(2, std::memory_order_relaxed);
+        while (state.load(std::memory_order_acquire) & PAUSED) { std::this_thread::yield(); }
+    }
+    for (size_t i = 0; i < params.size(); i++) {
+        fp_t grad = batch.grad_sum(params[i]) / batch.size;
+        grad = std::max(-clip, std::min(clip, grad));
+        if (grad == 0) continue;
+        fp_t v = values[i].load(std::memory_order_relaxed);
+        while (!values[i].compare_exchange_weak(v, v - learning_rate * grad, std::memory_order_relaxed)) {}
+    }
+    state.fetch_sub(2, std::memory_order_release);
+}
+
+std::vector<fp_t> ParameterStore::snapshot() {
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    for (Slot& slot: slots) { slot.state.fetch_or(PAUSED, std::memory_order_relaxed); }
+    for (Slot& slot: slots) {
+        while (slot.state.load(std::memory_order_acquire) != PAUSED) { std::this_thread::yield(); }
+    }
+    std::vector<fp_t> result(params.size());
+    for (size_t i = 0; i < params.size(); i++) { result[i] = get(i); }
+    for (Slot& slot: slots) { slot.state.fetch_and(~PAUSED, std::memory_order_release); }
+    return result;
+}
+
+void ParameterStore::write_back() {
+    std::vector<fp_t> v = snapshot();
+    for (size_t i = 0; i < params.size(); i++) { params[i]->value = v[i]; }
+}
+
+size_t train_hogwild(
+    Graph& graph, Node* loss, ParameterStore& store, const HogwildOptions& options,
+    const std::function<bool(size_t worker, Batch& batch)>& load
+) {
+    assert(loss->graph == &graph && options.batch_size > 0);
+    size_t n_threads = options.n_threads;
+    if (n_threads == 0) n_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::atomic<size_t> n_updates{0};
+
+    auto worker = [&](size_t id) {
+        Batch batch = graph.batch(options.batch_size);
+        while (load(id, batch)) {
+            store.read(batch);
+            graph.forward(batch);
+            batch.clear_grad();
+            graph.backward(batch, loss);
+            store.apply(id, batch, options.learning_rate, options.clip);
+            size_t n = n_updates.fetch_add(1, std::memory_order_relaxed) + 1;
+            if (options.snapshot_every != 0 && n % options.snapshot_every == 0 && options.on_snapshot) {
+                options.on_snapshot(store.snapshot(), n);
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < n_threads; i++) { threads.emplace_back(worker, i); }
+    worker(0);
+    for (auto& thread: threads) { thread.join(); }
+    return n_updates.load();
+}
+
+}
@@ -0,0 +1,73 @@
+/* Hogwild-style asynchronous training: lock-free updates of shared parameters */
+#pragma once
+#include "nn.h"
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace nn {
+
+// Parameter values shared by training threads. Reads and updates are relaxed
+// atomic operations on each value: workers never wait for each other, and a
+// worker may see some of the updates of another one in flight.
+// snapshot() is the only point of synchronization: it waits for updates in
+// progress to finish and holds new ones back while it copies the values.
+// Workers announce their updates on a cache line of their own, the shared
+// lines are only those of the parameter values themselves.
+struct ParameterStore {
+    // starts from the current values of `params`, leaves of the graph
+    ParameterStore(std::vector<Node*> params);
+
+    size_t size() const { return params.size(); }
+    const std::vector<Node*>& nodes() const { return params; }
+    fp_t get(size_t i) const { return values[i].load(std::memory_order_relaxed); }
+
+    // lanes of every parameter = its current shared value
+    void read(Batch& batch) const;
+    // parameter -= learning_rate * (mean gradient over the lanes, clipped to [-clip, clip]),
+    // `worker` picks the slot announcing the update (any number, ideally one per thread)
+    void apply(size_t worker, Batch& batch, fp_t learning_rate, fp_t clip = std::numeric_limits<fp_t>::infinity());
+
+    // Values from between two apply() calls, i.e. every update is either
+    // entirely in the snapshot or not at all
+    std::vector<fp_t> snapshot();
+    // node values = snapshot()
+    void write_back();
+
+private:
+    std::vector<Node*> params;
+    std::unique_ptr<std::atomic<fp_t>[]> values;
+    // 2 * (apply() calls in progress) | PAUSED while a snapshot is taken
+    struct alignas(64) Slot { std::atomic<size_t> state{0}; };
+    static const size_t N_SLOTS = 64;
+    static const size_t PAUSED = 1;
+    Slot slots[N_SLOTS];
+    std::mutex snapshot_mutex;              // one snapshot at a time, never taken by apply()
+    static_assert(std::atomic<fp_t>::is_always_lock_free, "parameter updates must be lock-free");
+};
+
+struct HogwildOptions {
+    size_t n_threads = 0;               // 0: one per core
+    size_t batch_size = 32;
+    fp_t learning_rate = 1e-2;
+    fp_t clip = std::numeric_limits<fp_t>::infinity();
+    // called by the worker completing every `snapshot_every`-th update (0: never)
+    size_t snapshot_every = 0;
+    std::function<void(const std::vector<fp_t>& params, size_t n_updates)> on_snapshot = nullptr;
+};
+
+// Trains `store` with SGD on `loss` in n_threads threads, without any barrier
+// between batches. Each worker evaluates the graph on its own Batch, the
+// graph is only read. load(worker, batch) sets the input lanes of the next
+// batch of the worker and returns false to stop it; it is called concurrently
+// by different workers. Returns the total number of updates, the final
+// parameters are in `store` (see ParameterStore::write_back).
+size_t train_hogwild(
+    Graph& graph, Node* loss, ParameterStore& store, const HogwildOptions& options,
+    const std::function<bool(size_t worker, Batch& batch)>& load
+);
+
+}
@@ -0,0 +1,124 @@
+#include "nn_kernels.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <cfloat>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NN_X86_DISPATCH 1
+#endif
+
+namespace nn {
+
+namespace simd_sse2 {
+#include "nn_kernels.inc"
+}
+
+#ifdef NN_X86_DISPATCH
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+namespace simd_avx2 {
+#include "nn_kernels.inc"
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512dq,avx2,fma,prefer-vector-width=512")
+namespace simd_avx512 {
+#include "nn_kernels.inc"
+}
+#pragma GCC pop_options
+#endif
+
+namespace {
+
+const Kernels& table(SimdLevel level) {
+    static const Kernels sse2 = simd_sse2::table();
+#ifdef NN_X86_DISPATCH
+    static const Kernels avx2 = simd_avx2::table();
+    static const Kernels avx512 = simd_avx512::table();
+    if (level == SimdLevel::AVX512) return avx512;
+    if (level == SimdLevel::AVX2) return avx2;
+#endif
+    return sse2;
+}
+
+SimdLevel detect_level() {
+    SimdLevel level = SimdLevel::SSE2;
+    while (level != SimdLevel::AVX512 && simd_supported(SimdLevel((int)level + 1))) {
+        level = SimdLevel((int)level + 1);
+    }
+    const char* env = std::getenv("MGRAD_SIMD");
+    if (env == nullptr) return level;
+    for (SimdLevel forced: {SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512}) {
+        if (std::string(env) != simd_name(forced)) continue;
+        if (simd_supported(forced)) return forced;
+        std::cerr << "[mgrad] MGRAD_SIMD=" << env << " is not supported by this CPU, using "
+                  << simd_name(level) << std::endl;
+        return level;
+    }
+    std::cerr << "[mgrad] unknown MGRAD_SIMD=" << env << ", using " << simd_name(level) << std::endl;
+    return level;
+}
+
+struct Dispatch {
+    SimdLevel level;
+    const Kernels* kernels;
+};
+const Dispatch& selection(SimdLevel level) {
+    static const Dispatch levels[] = {
+        {SimdLevel::SSE2, &table(SimdLevel::SSE2)},
+        {SimdLevel::AVX2, &table(SimdLevel::AVX2)},
+        {SimdLevel::AVX512, &table(SimdLevel::AVX512)},
+    };
+    return levels[(int)level];
+}
+// the selected level and table are switched together by one pointer store, so
+// set_simd_level is safe while other threads run batched ops
+std::atomic<const Dispatch*>& dispatch() {
+    static std::atomic<const Dispatch*> d{&selection(detect_level())};
+    return d;
+}
+// resolve the level at startup rather than inside the first batched op
+std::atomic<const Dispatch*>& startup_dispatch = dispatch();
+
+}
+
+bool simd_supported(SimdLevel level) {
+#ifdef NN_X86_DISPATCH
+    __builtin_cpu_init();
+    switch (level) {
+        case SimdLevel::SSE2: return true;
+        case SimdLevel::AVX2: return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        case SimdLevel::AVX512: return simd_supported(SimdLevel::AVX2)
+            && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq");
+    }
+    return false;
+#else
+    return level == SimdLevel::SSE2;
+#endif
+}
+
+const char* simd_name(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::SSE2: return "sse2";
+        case SimdLevel::AVX2: return "avx2";
+        case SimdLevel::AVX512: return "avx512";
+    }
+    return "unknown";
+}
+
+SimdLevel simd_level() { return dispatch().load(std::memory_order_acquire)->level; }
+const Kernels& kernels() { return *dispatch().load(std::memory_order_acquire)->kernels; }
+
+void set_simd_level(SimdLevel level) {
+    assert(simd_supported(level));
+    dispatch().store(&selection(level), std::memory_order_release);
+}
+
+}
@@ -0,0 +1,68 @@
+/* Array kernels behind batched execution, compiled once per instruction set */
+#pragma once
+#include "nn.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace nn {
+
+enum class SimdLevel {
+    SSE2,       // x86-64 baseline, the only level on other architectures
+    AVX2,       // AVX2 + FMA
+    AVX512,     // AVX-512 F/DQ with 512-bit vectors
+};
+
+// One table per instruction set. All tables compute bit-identical results as
+// long as nn_kernels.cc is built with -ffp-contract=off (see makefile), so
+// that FMA units never fuse a multiply with an add.
+struct Kernels {
+    typedef void (*Unary)(const fp_t* x, fp_t* y, size_t n);
+    typedef void (*Binary)(const fp_t* a, const fp_t* b, fp_t* y, size_t n);
+    typedef void (*Ternary)(const fp_t* a, const fp_t* b, const fp_t* c, fp_t* y, size_t n);
+    typedef void (*Quaternary)(const fp_t* a, const fp_t* b, const fp_t* c, const fp_t* d, fp_t* y, size_t n);
+
+    // y = f(x) / y = f(a, b)
+    Binary add, sub, mul, div, max, min;
+    Unary neg, abs, relu;
+    // MathMode::Fast transcendentals, see nn_math.h
+    Unary exp, log, sin, cos, tanh, sigmoid;
+
+    // gradient accumulation, y += ...
+    Unary acc;              // x
+    Unary acc_neg;          // -x
+    Binary acc_mul;         // a * b
+    Binary acc_mul_neg;     // -(a * b)
+    Binary acc_div;         // a / b
+    Binary acc_sign;        // b > 0 ? a : -a
+    Binary acc_pos;         // b > 0 ? a : 0
+    Ternary acc_gt;         // b > c ? a : 0
+    Ternary acc_mul3;       // a * b * c
+    Ternary acc_div_grad;   // -(a * b / (c * c))
+    Binary acc_sigmoid;     // a * b * (1 - b)
+    Binary acc_tanh;        // a * (1 - b * b)
+    Ternary acc_mul_sub;    // a * (b - c)
+    Quaternary acc_xent;    // a * (b * c - d)
+
+    // one step of a running log-sum-exp (log_sum_exp in nn_ops.cc): e = exp(-|x - m|)
+    // from neg_abs_diff(x, m), then s = x > m ? s * e + 1 : s + e and m = max(m, x)
+    Binary neg_abs_diff;    // -|a - b|
+    void (*lse_step)(const fp_t* x, const fp_t* e, fp_t* m, fp_t* s, size_t n);
+
+    // int8 inference, see nn_quant.h: y[o] = bias[o] + sum_i w[o * n_in + i] * x[i]
+    void (*gemv_i8)(const int8_t* w, const int8_t* x, const int32_t* bias, int32_t* y, size_t n_out, size_t n_in);
+};
+
+// Level and table picked from the running CPU during static initialization.
+// The environment variable MGRAD_SIMD=sse2|avx2|avx512 selects that level if
+// the CPU supports it, otherwise the detected level is kept (with a warning).
+SimdLevel simd_level();
+const Kernels& kernels();
+
+bool simd_supported(SimdLevel level);
+// must be supported, for tests and benchmarks; may be called while other
+// threads run batched ops (the levels give identical results, so an op that
+// sees the switch midway is unaffected)
+void set_simd_level(SimdLevel level);
+const char* simd_name(SimdLevel level);
+
+}
@@ -0,0 +1,30 @@
+#include "nn_math.h"
+#include "nn_kernels.h"
+#include <cmath>
+
+namespace nn {
+namespace math {
+
+namespace {
+inline fp_t sigmoid_exact(fp_t x) { return 1 / (1 + std::exp(-x)); }
+}
+
+#define IMPL_MATH_FN(FN, EXACT) \
+    void FN(const fp_t* x, fp_t* y, size_t n, MathMode mode) { \
+        if (mode == MathMode::Fast) { kernels().FN(x, y, n); return; } \
+        for (size_t i = 0; i < n; i++) { y[i] = EXACT(x[i]); } \
+    }
+
+IMPL_MATH_FN(exp, std::exp)
+IMPL_MATH_FN(log, std::log)
+IMPL_MATH_FN(sin, std::sin)
+IMPL_MATH_FN(cos, std::cos)
+IMPL_MATH_FN(tanh, std::tanh)
+IMPL_MATH_FN(sigmoid, sigmoid_exact)
+
+void pow(const fp_t* a, const fp_t* b, fp_t* y, size_t n) {
+    for (size_t i = 0; i < n; i++) { y[i] = std::pow(a[i], b[i]); }
+}
+
+}
+}
@@ -0,0 +1,24 @@
+/* Transcendental functions over arrays, used by batched op execution */
+#pragma once
+#include "nn.h"
+#include <cstddef>
+
+namespace nn {
+namespace math {
+
+// y[i] = f(x[i]) for i < n, y may alias x.
+// MathMode::Exact calls libm per element, MathMode::Fast evaluates branch-free
+// polynomial approximations that the compiler vectorizes; out-of-range and
+// non-finite inputs fall back to libm in both modes.
+void exp(const fp_t* x, fp_t* y, size_t n, MathMode mode = MathMode::Exact);
+void log(const fp_t* x, fp_t* y, size_t n, MathMode mode = MathMode::Exact);
+void sin(const fp_t* x, fp_t* y, size_t n, MathMode mode = MathMode::Exact);
+void cos(const fp_t* x, fp_t* y, size_t n, MathMode mode = MathMode::Exact);
+void tanh(const fp_t* x, fp_t* y, size_t n, MathMode mode = MathMode::Exact);
+void sigmoid(const fp_t* x, fp_t* y, size_t n, MathMode mode = MathMode::Exact);
+
+// y[i] = a[i]^b[i], always libm: exp(b * log(a)) cannot keep a bounded ULP error
+void pow(const fp_t* a, const fp_t* b, fp_t* y, size_t n);
+
+}
+}
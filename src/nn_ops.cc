@@ -1,4 +1,6 @@
 #include "nn.h"
+#include "nn_math.h"
+#include "nn_kernels.h"
 #include <cmath>
 
 namespace nn {
@@ -10,6 +12,14 @@ void OpAdd::backward(fp_t grad) {
     if (inputs[0]->requires_grad) inputs[0]->grad += grad;    // 1 * grad
     if (inputs[1]->requires_grad) inputs[1]->grad += grad;
 }
+void OpAdd::forward(Batch& b) {
+    kernels().add(b.value(inputs[0]), b.value(inputs[1]), b.value(output), b.size);
+}
+void OpAdd::backward(Batch& b) {
+    const fp_t* g = b.grad(output);
+    if (inputs[0]->requires_grad) kernels().acc(g, b.grad(inputs[0]), b.size);
+    if (inputs[1]->requires_grad) kernels().acc(g, b.grad(inputs[1]), b.size);
+}
 
 void OpSub::forward() {
     output->value = inputs[0]->value - inputs[1]->value;
@@ -18,6 +28,14 @@ void OpSub::backward(fp_t grad) {
     if (inputs[0]->requires_grad) inputs[0]->grad += grad;    // 1 * grad
     if (inputs[1]->requires_grad) inputs[1]->grad -= grad;    // -1 * grad
 }
+void OpSub::forward(Batch& b) {
+    kernels().sub(b.value(inputs[0]), b.value(inputs[1]), b.value(output), b.size);
+}
+void OpSub::backward(Batch& b) {
+    const fp_t* g = b.grad(output);
+    if (inputs[0]->requires_grad) kernels().acc(g, b.grad(inputs[0]), b.size);
+    if (inputs[1]->requires_grad) kernels().acc_neg(g, b.grad(inputs[1]), b.size);
+}
 
 void OpMult::forward() {
     output->value = inputs[0]->value * inputs[1]->value;
@@ -26,6 +44,14 @@ void OpMult::backward(fp_t grad) {
     if (inputs[0]->requires_grad) inputs[0]->grad += grad * inputs[1]->value;
     if (inputs[1]->requires_grad) inputs[1]->grad += grad * inputs[0]->value;
 }
+void OpMult::forward(Batch& b) {
+    kernels().mul(b.value(inputs[0]), b.value(inputs[1]), b.value(output), b.size);
+}
+void OpMult::backward(Batch& b) {
+    const fp_t* g = b.grad(output);
+    if (inputs[0]->requires_grad) kernels().acc_mul(g, b.value(inputs[1]), b.grad(inputs[0]), b.size);
+    if (inputs[1]->requires_grad) kernels().acc_mul(g, b.value(inputs[0]), b.grad(inputs[1]), b.size);
+}
 
 // f(x) = a / b -> ∂f/∂a = 1 / b, ∂f/∂b = -a / b^2
 void OpDiv::forward() {
@@ -35,6 +61,14 @@ void OpDiv::backward(fp_t grad) {
     if (inputs[0]->requires_grad) inputs[0]->grad += grad / inputs[1]->value;
     if (inputs[1]->requires_grad) inputs[1]->grad -= grad * inputs[0]->value / (inputs[1]->value * inputs[1]->value);
 }
+void OpDiv::forward(Batch& b) {
+    kernels().div(b.value(inputs[0]), b.value(inputs[1]), b.value(output), b.size);
+}
+void OpDiv::backward(Batch& b) {
+    const fp_t *g = b.grad(output), *x0 = b.value(inputs[0]), *x1 = b.value(inputs[1]);
+    if (inputs[0]->requires_grad) kernels().acc_div(g, x1, b.grad(inputs[0]), b.size);
+    if (inputs[1]->requires_grad) kernels().acc_div_grad(g, x0, x1, b.grad(inputs[1]), b.size);
+}
 
 // f(x) = a^b -> ∂f/∂a = b * a^(b-1), ∂f/∂b = a^b * log(a)
 void OpPow::forward() {
@@ -42,7 +76,23 @@ void OpPow::forward() {
 }
 void OpPow::backward(fp_t grad) {
     if (inputs[0]->requires_grad) inputs[0]->grad += grad * inputs[1]->value * pow(inputs[0]->value, inputs[1]->value - 1);
-    if (inputs[1]->requires_grad) inputs[1]->grad += grad * pow(inputs[0]->value, inputs[1]->value) * log(inputs[0]->value);
+    if (inputs[1]->requires_grad) inputs[1]->grad += grad * output->value * log(inputs[0]->value);
+}
+void OpPow::forward(Batch& b) {
+    math::pow(b.value(inputs[0]), b.value(inputs[1]), b.value(output), b.size);
+}
+void OpPow::backward(Batch& b) {
+    const fp_t *g = b.grad(output), *x0 = b.value(inputs[0]), *x1 = b.value(inputs[1]);
+    fp_t* t = b.scratch.data();
+    if (inputs[0]->requires_grad) {
+        for (size_t i = 0; i < b.size; i++) t[i] = x1[i] - 1;
+        math::pow(x0, t, t, b.size);
+        kernels().acc_mul3(g, x1, t, b.grad(inputs[0]), b.size);
+    }
+    if (inputs[1]->requires_grad) {
+        math::log(x0, t, b.size, b.math_mode);
+        kernels().acc_mul3(g, b.value(output), t, b.grad(inputs[1]), b.size);
+    }
 }
 
 void OpMax::forward() {
@@ -52,6 +102,14 @@ void OpMax::backward(fp_t grad) {
     if (inputs[0]->requires_grad && inputs[0]->value > inputs[1]->value) inputs[0]->grad += grad;
     if (inputs[1]->requires_grad && inputs[1]->value > inputs[0]->value) inputs[1]->grad += grad;
 }
+void OpMax::forward(Batch& b) {
+    kernels().max(b.value(inputs[0]), b.value(inputs[1]), b.value(output), b.size);
+}
+void OpMax::backward(Batch& b) {
+    const fp_t *g = b.grad(output), *x0 = b.value(inputs[0]), *x1 = b.value(inputs[1]);
+    if (inputs[0]->requires_grad) kernels().acc_gt(g, x0, x1, b.grad(inputs[0]), b.size);
+    if (inputs[1]->requires_grad) kernels().acc_gt(g, x1, x0, b.grad(inputs[1]), b.size);
+}
 
 void OpMin::forward() {
     output->value = std::min(inputs[0]->value, inputs[1]->value);
@@ -60,6 +118,14 @@ void OpMin::backward(fp_t grad) {
     if (inputs[0]->requires_grad && inputs[0]->value < inputs[1]->value) inputs[0]->grad += grad;
     if (inputs[1]->requires_grad && inputs[1]->value < inputs[0]->value) inputs[1]->grad += grad;
 }
+void OpMin::forward(Batch& b) {
+    kernels().min(b.value(inputs[0]), b.value(inputs[1]), b.value(output), b.size);
+}
+void OpMin::backward(Batch& b) {
+    const fp_t *g = b.grad(output), *x0 = b.value(inputs[0]), *x1 = b.value(inputs[1]);
+    if (inputs[0]->requires_grad) kernels().acc_gt(g, x1, x0, b.grad(inputs[0]), b.size);
+    if (inputs[1]->requires_grad) kernels().acc_gt(g, x0, x1, b.grad(inputs[1]), b.size);
+}
 
 // f(x) = log(a) -> ∂f/∂a = 1 / a
 void OpLog::forward() {
@@ -68,6 +134,12 @@ void OpLog::forward() {
 void OpLog::backward(fp_t grad) {
     if (inputs[0]->requires_grad) inputs[0]->grad += grad / inputs[0]->value;
 }
+void OpLog::forward(Batch& b) {
+    math::log(b.value(inputs[0]), b.value(output), b.size, b.math_mode);
+}
+void OpLog::backward(Batch& b) {
+    if (inputs[0]->requires_grad) kernels().acc_div(b.grad(output), b.value(inputs[0]), b.grad(inputs[0]), b.size);
+}
 
 void OpMinus::forward() {
     output->value = -inputs[0]->value;
@@ -75,6 +147,12 @@ void OpMinus::forward() {
 void OpMinus::backward(fp_t grad) {
     if (inputs[0]->requires_grad) inputs[0]->grad -= grad;
 }
+void OpMinus::forward(Batch& b) {
+    kernels().neg(b.value(inputs[0]), b.value(output), b.size);
+}
+void OpMinus::backward(Batch& b) {
+    if (inputs[0]->requires_grad) kernels().acc_neg(b.grad(output), b.grad(inputs[0]), b.size);
+}
 
 void OpAbs::forward() {
     output->value = std::abs(inputs[0]->value);
@@ -82,6 +160,12 @@ void OpAbs::forward() {
 void OpAbs::backward(fp_t grad) {
     if (inputs[0]->requires_grad) inputs[0]->grad += grad * (inputs[0]->value > 0 ? 1 : -1);
 }
+void OpAbs::forward(Batch& b) {
+    kernels().abs(b.value(inputs[0]), b.value(output), b.size);
+}
+void OpAbs::backward(Batch& b) {
+    if (inputs[0]->requires_grad) kernels().acc_sign(b.grad(output), b.value(inputs[0]), b.grad(inputs[0]), b.size);
+}
 
 // f(x) = sin(x) -> ∂f/∂x = cos(x)
 void OpSin::forward() {
@@ -90,6 +174,15 @@ void OpSin::forward() {
 void OpSin::backward(fp_t grad) {
     if (inputs[0]->requires_grad) inputs[0]->grad += grad * cos(inputs[0]->value);
 }
+void OpSin::forward(Batch& b) {
+    math::sin(b.value(inputs[0]), b.value(output), b.size, b.math_mode);
+}
+void OpSin::backward(Batch& b) {
+    if (!inputs[0]->requires_grad) return;
+    fp_t* t = b.scratch.data();
+    math::cos(b.value(inputs[0]), t, b.size, b.math_mode);
+    kernels().acc_mul(b.grad(output), t, b.grad(inputs[0]), b.size);
+}
 
 // f(x) = cos(x) -> ∂f/∂x = -sin(x)
 void OpCos::forward() {
@@ -98,6 +191,15 @@ void OpCos::forward() {
 void OpCos::backward(fp_t grad) {
     if (inputs[0]->requires_grad) inputs[0]->grad -= grad * sin(inputs[0]->value);
 }
+void OpCos::forward(Batch& b) {
+    math::cos(b.value(inputs[0]), b.value(output), b.size, b.math_mode);
+}
+void OpCos::backward(Batch& b) {
+    if (!inputs[0]->requires_grad) return;
+    fp_t* t = b.scratch.data();
+    math::sin(b.value(inputs[0]), t, b.size, b.math_mode);
+    kernels().acc_mul_neg(b.grad(output), t, b.grad(inputs[0]), b.size);
+}
 
 void OpRelu::forward() {
     output->value = inputs[0]->value > 0 ? inputs[0]->value : 0;
@@ -105,6 +207,12 @@ void OpRelu::forward() {
 void OpRelu::backward(fp_t grad) {
     if (inputs[0]->requires_grad) inputs[0]->grad += grad * (inputs[0]->value > 0 ? 1 : 0);
 }
+void OpRelu::forward(Batch& b) {
+    kernels().relu(b.value(inputs[0]), b.value(output), b.size);
+}
+void OpRelu::backward(Batch& b) {
+    if (inputs[0]->requires_grad) kernels().acc_pos(b.grad(output), b.value(inputs[0]), b.grad(inputs[0]), b.size);
+}
 
 // f(x) = 1 / (1 + exp(-x)) -> ∂f/∂x = f(x) * (1 - f(x))
 void OpSigmoid::forward() {
@@ -114,6 +222,12 @@ void OpSigmoid::backward(fp_t grad) {
     fp_t s = output->value;
     if (inputs[0]->requires_grad) inputs[0]->grad += grad * s * (1 - s);
 }
+void OpSigmoid::forward(Batch& b) {
+    math::sigmoid(b.value(inputs[0]), b.value(output), b.size, b.math_mode);
+}
+void OpSigmoid::backward(Batch& b) {
+    if (inputs[0]->requires_grad) kernels().acc_sigmoid(b.grad(output), b.value(output), b.grad(inputs[0]), b.size);
+}
 
 // f(x) = tanh(x) -> ∂f/∂x = 1 - f(x)^2
 void OpTanh::forward() {
@@ -123,5 +237,124 @@ void OpTanh::backward(fp_t grad) {
     fp_t t = output->value;
     if (inputs[0]->requires_grad) inputs[0]->grad += grad * (1 - t * t);
 }
+void OpTanh::forward(Batch& b) {
+    math::tanh(b.value(inputs[0]), b.value(output), b.size, b.math_mode);
+}
+void OpTanh::backward(Batch& b) {
+    if (inputs[0]->requires_grad) kernels().acc_tanh(b.grad(output), b.value(output), b.grad(inputs[0]), b.size);
+}
 
-}
\ No newline at end of file
+// f(x) = exp(x) -> ∂f/∂x = exp(x)
+void OpExp::forward() {
+    output->value = std::exp(inputs[0]->value);
+}
+void OpExp::backward(fp_t grad) {
+    if (inputs[0]->requires_grad) inputs[0]->grad += grad * output->value;
+}
+void OpExp::forward(Batch& b) {
+    math::exp(b.value(inputs[0]), b.value(output), b.size, b.math_mode);
+}
+void OpExp::backward(Batch& b) {
+    if (inputs[0]->requires_grad) kernels().acc_mul(b.grad(output), b.value(output), b.grad(inputs[0]), b.size);
+}
+
+namespace {
+// log(sum_i exp(x_i)) in one pass: the sum s is kept relative to the running
+// maximum m and rescaled when the maximum grows, so no exp() ever overflows
+fp_t log_sum_exp(const std::vector<Node*>& x, size_t n) {
+    fp_t m = -INFINITY, s = 0;
+    for (size_t i = 0; i < n; i++) {
+        fp_t d = x[i]->value - m;
+        fp_t e = std::exp(-std::abs(d));
+        if (d > 0) { s = s * e + 1; m = x[i]->value; }
+        else s += e;
+    }
+    return m + std::log(s);
+}
+
+// the same for every lane, into lse; uses the 3 scratch lanes of the batch
+void log_sum_exp(Batch& b, const std::vector<Node*>& x, size_t n, fp_t* lse) {
+    fp_t *m = lse, *s = b.scratch.data(), *e = s + b.size;
+    std::fill_n(m, b.size, -INFINITY);
+    std::fill_n(s, b.size, 0);
+    for (size_t i = 0; i < n; i++) {
+        const fp_t* xi = b.value(x[i]);
+        kernels().neg_abs_diff(xi, m, e, b.size);
+        math::exp(e, e, b.size, b.math_mode);
+        kernels().lse_step(xi, e, m, s, b.size);
+    }
+    math::log(s, s, b.size, b.math_mode);
+    kernels().add(m, s, lse, b.size);
+}
+}
+
+// f(x) = log(sum_i exp(x_i)) -> ∂f/∂x_i = exp(x_i - f) = softmax(x)_i
+void OpLogSumExp::forward() {
+    output->value = log_sum_exp(inputs, inputs.size());
+}
+void OpLogSumExp::backward(fp_t grad) {
+    for (Node* x: inputs) {
+        if (x->requires_grad) x->grad += grad * std::exp(x->value - output->value);
+    }
+}
+void OpLogSumExp::forward(Batch& b) {
+    log_sum_exp(b, inputs, inputs.size(), b.value(output));
+}
+void OpLogSumExp::backward(Batch& b) {
+    fp_t* t = b.scratch.data();
+    for (Node* x: inputs) {
+        if (!x->requires_grad) continue;
+        kernels().sub(b.value(x), b.value(output), t, b.size);
+        math::exp(t, t, b.size, b.math_mode);
+        kernels().acc_mul(b.grad(output), t, b.grad(x), b.size);
+    }
+}
+
+// f(x, y) = sum_i y_i * (lse(x) - x_i)
+//   -> ∂f/∂x_i = p_i * sum_j y_j - y_i with p = softmax(x), = p_i - y_i for a distribution y
+//   -> ∂f/∂y_i = lse(x) - x_i
+// The log-sum-exp is recomputed in backward, ops hold no per-evaluation state.
+void OpSoftmaxCrossEntropy::forward() {
+    size_t n = inputs.size() / 2;
+    fp_t lse = log_sum_exp(inputs, n), loss = 0;
+    for (size_t i = 0; i < n; i++) { loss += inputs[n + i]->value * (lse - inputs[i]->value); }
+    output->value = loss;
+}
+void OpSoftmaxCrossEntropy::backward(fp_t grad) {
+    size_t n = inputs.size() / 2;
+    fp_t lse = log_sum_exp(inputs, n), y_sum = 0;
+    for (size_t i = 0; i < n; i++) { y_sum += inputs[n + i]->value; }
+    for (size_t i = 0; i < n; i++) {
+        Node *x = inputs[i], *y = inputs[n + i];
+        if (x->requires_grad) x->grad += grad * (std::exp(x->value - lse) * y_sum - y->value);
+        if (y->requires_grad) y->grad += grad * (lse - x->value);
+    }
+}
+void OpSoftmaxCrossEntropy::forward(Batch& b) {
+    size_t n = inputs.size() / 2;
+    fp_t* loss = b.value(output);
+    fp_t* lse = b.scratch.data() + 2 * b.size;
+    log_sum_exp(b, inputs, n, lse);
+    std::fill_n(loss, b.size, 0);
+    for (size_t i = 0; i < n; i++) { kernels().acc_mul_sub(b.value(inputs[n + i]), lse, b.value(inputs[i]), loss, b.size); }
+}
+void OpSoftmaxCrossEntropy::backward(Batch& b) {
+    size_t n = inputs.size() / 2;
+    fp_t *lse = b.scratch.data() + 2 * b.size, *y_sum = b.scratch.data(), *t = y_sum + b.size;
+    const fp_t* g = b.grad(output);
+    log_sum_exp(b, inputs, n, lse);
+    std::fill_n(y_sum, b.size, 0);
+    for (size_t i = 0; i < n; i++) { kernels().acc(b.value(inputs[n + i]), y_sum, b.size); }
+    for (size_t i = 0; i < n; i++) {
+        Node *x = inputs[i], *y = inputs[n + i];
+        const fp_t *xv = b.value(x), *yv = b.value(y);
+        if (x->requires_grad) {
+            kernels().sub(xv, lse, t, b.size);
+            math::exp(t, t, b.size, b.math_mode);
+            kernels().acc_xent(g, t, y_sum, yv, b.grad(x), b.size);
+        }
+        if (y->requires_grad) kernels().acc_mul_sub(g, lse, xv, b.grad(y), b.size);
+    }
+}
+
+}
@@ -0,0 +1,294 @@
+#include "nn_quant.h"
+#include "nn_kernels.h"
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace nn {
+
+QuantParams QuantParams::from_range(fp_t lo, fp_t hi) {
+    lo = std::min<fp_t>(lo, 0);
+    hi = std::max<fp_t>(hi, 0);
+    QuantParams p;
+    p.scale = (hi - lo) / 255;
+    if (!(p.scale > 0) || !std::isfinite(p.scale)) p.scale = 1;
+    p.zero = std::max(-128, std::min(127, (int32_t)std::lround(-128 - lo / p.scale)));
+    return p;
+}
+
+int8_t QuantParams::quantize(fp_t v) const {
+    fp_t q = std::nearbyint(v / scale) + zero;
+    if (std::isnan(q)) return zero;
+    return (int8_t)std::max<fp_t>(-128, std::min<fp_t>(127, q));
+}
+
+namespace {
+
+enum class Activation { None, Relu, Sigmoid, Tanh };
+
+fp_t activate(Activation act, fp_t x) {
+    switch (act) {
+        case Activation::Relu: return x > 0 ? x : 0;
+        case Activation::Sigmoid: return 1 / (1 + std::exp(-x));
+        case Activation::Tanh: return std::tanh(x);
+        default: return x;
+    }
+}
+
+// out[o] = act(pre[o]), pre[o] = bias[o] + sum_i weight[o][i] * in[i]
+struct DenseLayer {
+    std::vector<Node*> in, pre, out;
+    std::vector<fp_t> weight, bias;
+    Activation act = Activation::None;
+};
+
+std::runtime_error not_an_mlp(std::string why) { return std::runtime_error("quantize_mlp: " + why); }
+
+// reads the layer computing `out` from the graph; a leaf term is a bias only
+// if it is neither a graph input nor a weight
+DenseLayer find_layer(
+    const std::vector<Node*>& out, const std::unordered_set<Node*>& inputs, const std::unordered_set<Node*>& weights
+) {
+    DenseLayer layer;
+    layer.out = out;
+    std::unordered_map<Node*, size_t> column;
+    std::vector<std::vector<std::pair<size_t, fp_t>>> rows(out.size());
+    layer.bias.assign(out.size(), 0);
+    for (size_t o = 0; o < out.size(); o++) {
+        Node* node = out[o];
+        Activation act = Activation::None;
+        if (dynamic_cast<OpRelu*>(node->op) != nullptr) act = Activation::Relu;
+        else if (dynamic_cast<OpSigmoid*>(node->op) != nullptr) act = Activation::Sigmoid;
+        else if (dynamic_cast<OpTanh*>(node->op) != nullptr) act = Activation::Tanh;
+        if (o > 0 && act != layer.act) throw not_an_mlp("the outputs of a layer have different activations");
+        layer.act = act;
+        if (act != Activation::None) node = node->op->inputs[0];
+        layer.pre.push_back(node);
+        if (dynamic_cast<OpAdd*>(node->op) == nullptr && dynamic_cast<OpMult*>(node->op) == nullptr) {
+            throw not_an_mlp("'" + node->name + "' is not a weighted sum");
+        }
+        // sums of weight * input products and leaves (bias)
+        std::vector<Node*> stack = {node};
+        while (!stack.empty()) {
+            Node* term = stack.back();
+            stack.pop_back();
+            if (term->op == nullptr) {
+                if (inputs.count(term)) throw not_an_mlp("the input '" + term->name + "' is added without a weight");
+                if (weights.count(term)) throw not_an_mlp("the weight '" + term->name + "' is also added as a bias");
+                layer.bias[o] += term->value;
+            } else if (dynamic_cast<OpAdd*>(term->op) != nullptr) {
+                stack.push_back(term->op->inputs[1]);
+                stack.push_back(term->op->inputs[0]);
+            } else if (dynamic_cast<OpMult*>(term->op) != nullptr && term->op->inputs[0]->op == nullptr) {
+                Node* x = term->op->inputs[1];
+                auto it = column.emplace(x, layer.in.size()).first;
+                if (it->second == layer.in.size()) layer.in.push_back(x);
+                rows[o].emplace_back(it->second, term->op->inputs[0]->value);
+            } else {
+                throw not_an_mlp("'" + term->name + "' (" + term->op->name + ") is neither a weight product nor a bias");
+            }
+        }
+    }
+    layer.weight.assign(out.size() * layer.in.size(), 0);
+    for (size_t o = 0; o < out.size(); o++) {
+        for (auto [i, w]: rows[o]) { layer.weight[o * layer.in.size() + i] += w; }
+    }
+    return layer;
+}
+
+// input order of the first layer = the order of the graph inputs
+void reorder_inputs(DenseLayer& layer, const std::vector<Node*>& inputs) {
+    std::unordered_map<Node*, size_t> position;
+    for (size_t i = 0; i < inputs.size(); i++) position[inputs[i]] = i;
+    std::vector<fp_t> weight(layer.out.size() * inputs.size(), 0);
+    for (size_t j = 0; j < layer.in.size(); j++) {
+        size_t i = position.at(layer.in[j]);
+        for (size_t o = 0; o < layer.out.size(); o++) {
+            weight[o * inputs.size() + i] = layer.weight[o * layer.in.size() + j];
+        }
+    }
+    layer.in = inputs;
+    layer.weight = weight;
+}
+
+// M ~ multiplier * 2^-shift with a 31-bit multiplier
+void fixed_point(double M, int32_t& multiplier, int& shift) {
+    multiplier = 0;
+    shift = 0;
+    if (!(M > 0)) return;
+    int e;
+    double f = std::frexp(M, &e);
+    shift = 31 - e;
+    int64_t m = std::llround(std::ldexp(f, 31));
+    if (m == (int64_t(1) << 31)) { m >>= 1; shift--; }
+    multiplier = (int32_t)m;
+    if (shift > 62) { multiplier = 0; shift = 0; }
+    else if (shift < 0) { multiplier = std::numeric_limits<int32_t>::max(); shift = 0; }     // saturates
+}
+
+}
+
+size_t QuantizedMlp::weight_bytes() const {
+    size_t bytes = 0;
+    for (auto& layer: layers) {
+        bytes += layer.weight.size() * sizeof(int8_t) + layer.bias.size() * sizeof(int32_t);
+        bytes += layer.multiplier.size() * sizeof(int32_t) + layer.shift.size() * sizeof(int) + sizeof(layer.table);
+    }
+    return bytes;
+}
+
+void QuantizedMlp::predict(const fp_t* inputs, size_t n, fp_t* outputs) const {
+    size_t width = n_inputs();
+    for (auto& layer: layers) width = std::max(width, layer.n_out);
+    std::vector<int8_t> x(width), y(width);
+    std::vector<int32_t> acc(width);
+    const auto gemv = kernels().gemv_i8;
+    for (size_t r = 0; r < n; r++) {
+        for (size_t i = 0; i < n_inputs(); i++) x[i] = input.quantize(inputs[r * n_inputs() + i]);
+        for (auto& layer: layers) {
+            gemv(layer.weight.data(), x.data(), layer.bias.data(), acc.data(), layer.n_out, layer.n_in);
+            // requantize to the pre-activation, then activation and output quantization by table
+            for (size_t o = 0; o < layer.n_out; o++) {
+                int64_t v = (int64_t)acc[o] * layer.multiplier[o];
+                if (layer.shift[o] > 0) v = (v + (int64_t(1) << (layer.shift[o] - 1))) >> layer.shift[o];
+                v = std::max<int64_t>(-128, std::min<int64_t>(127, v + layer.pre_zero));
+                y[o] = layer.table[v + 128];
+            }
+            std::swap(x, y);
+        }
+        for (size_t o = 0; o < n_outputs(); o++) outputs[r * n_outputs() + o] = activations.back().dequantize(x[o]);
+    }
+}
+
+QuantizedMlp quantize_mlp(
+    Graph& graph, const std::vector<Node*>& inputs, const std::vector<Node*>& outputs,
+    const fp_t* calibration, size_t n
+) {
+    assert(!inputs.empty() && !outputs.empty() && n > 0);
+    // layers from the outputs back to the inputs
+    std::unordered_set<Node*> input_set(inputs.begin(), inputs.end()), weights;
+    for (OpNode* op: graph.ops) {
+        if (dynamic_cast<OpMult*>(op) != nullptr && op->inputs[0]->op == nullptr) weights.insert(op->inputs[0]);
+    }
+    std::vector<DenseLayer> dense;
+    std::vector<Node*> out = outputs;
+    while (true) {
+        if (dense.size() > graph.nodes.size()) throw not_an_mlp("cyclic layers");
+        dense.push_back(find_layer(out, input_set, weights));
+        DenseLayer& layer = dense.back();
+        size_t n_graph_inputs = 0;
+        for (Node* node: layer.in) n_graph_inputs += input_set.count(node);
+        if (n_graph_inputs == 0) { out = layer.in; continue; }
+        if (n_graph_inputs != layer.in.size()) throw not_an_mlp("a layer mixes graph inputs and hidden nodes");
+        reorder_inputs(layer, inputs);
+        break;
+    }
+    std::reverse(dense.begin(), dense.end());
+
+    // per tensor ranges: pre-activations and outputs of every layer, from the graph itself
+    std::vector<Node*> probes;
+    for (auto& layer: dense) {
+        probes.insert(probes.end(), layer.pre.begin(), layer.pre.end());
+        probes.insert(probes.end(), layer.out.begin(), layer.out.end());
+    }
+    const fp_t inf = std::numeric_limits<fp_t>::infinity();
+    std::vector<fp_t> pre_lo(dense.size(), inf), pre_hi(dense.size(), -inf);
+    std::vector<fp_t> out_lo(dense.size(), inf), out_hi(dense.size(), -inf);
+    fp_t in_lo = inf, in_hi = -inf;
+    for (size_t i = 0; i < n * inputs.size(); i++) { in_lo = std::min(in_lo, calibration[i]); in_hi = std::max(in_hi, calibration[i]); }
+    const size_t chunk = 1024;
+    std::vector<fp_t> values(chunk * probes.size());
+    for (size_t begin = 0; begin < n; begin += chunk) {
+        size_t count = std::min(chunk, n - begin);
+        graph.predict(inputs, calibration + begin * inputs.size(), count, probes, values.data());
+        for (size_t r = 0; r < count; r++) {
+            const fp_t* v = &values[r * probes.size()];
+            for (size_t k = 0; k < dense.size(); k++) {
+                for (size_t o = 0; o < dense[k].out.size(); o++, v++) { pre_lo[k] = std::min(pre_lo[k], *v); pre_hi[k] = std::max(pre_hi[k], *v); }
+                for (size_t o = 0; o < dense[k].out.size(); o++, v++) { out_lo[k] = std::min(out_lo[k], *v); out_hi[k] = std::max(out_hi[k], *v); }
+            }
+        }
+    }
+
+    QuantizedMlp mlp;
+    mlp.input = QuantParams::from_range(in_lo, in_hi);
+    for (size_t k = 0; k < dense.size(); k++) {
+        const DenseLayer& d = dense[k];
+        const QuantParams in = k == 0 ? mlp.input : mlp.activations.back();
+        const QuantParams out = QuantParams::from_range(out_lo[k], out_hi[k]);
+        // Relu and identity commute with the output quantization, which then takes all the
+        // resolution; tanh and sigmoid only need the range where they are not saturated in int8
+        const fp_t saturation = d.act == Activation::Tanh ? 4 : 8;
+        const QuantParams pre = d.act == Activation::None || d.act == Activation::Relu ? out
+            : QuantParams::from_range(std::max(pre_lo[k], -saturation), std::min(pre_hi[k], saturation));
+        QuantizedLayer layer;
+        layer.n_in = d.in.size();
+        layer.n_out = d.out.size();
+        layer.weight.resize(layer.n_out * layer.n_in);
+        layer.bias.resize(layer.n_out);
+        layer.multiplier.resize(layer.n_out);
+        layer.shift.resize(layer.n_out);
+        layer.pre_zero = pre.zero;
+        for (size_t o = 0; o < layer.n_out; o++) {
+            const fp_t* w = &d.weight[o * layer.n_in];
+            fp_t w_max = 0;
+            for (size_t i = 0; i < layer.n_in; i++) w_max = std::max(w_max, std::abs(w[i]));
+            fp_t w_scale = w_max > 0 ? w_max / 127 : 1;
+            int64_t w_sum = 0;
+            for (size_t i = 0; i < layer.n_in; i++) {
+                int8_t q = (int8_t)std::lround(w[i] / w_scale);
+                layer.weight[o * layer.n_in + i] = q;
+                w_sum += q;
+            }
+            fp_t acc_scale = in.scale * w_scale;
+            fp_t bias = std::nearbyint(d.bias[o] / acc_scale) - (fp_t)in.zero * w_sum;
+            bias = std::max<fp_t>(std::numeric_limits<int32_t>::min(), std::min<fp_t>(std::numeric_limits<int32_t>::max(), bias));
+            layer.bias[o] = (int32_t)bias;
+            fixed_point(acc_scale / pre.scale, layer.multiplier[o], layer.shift[o]);
+        }
+        for (int q = -128; q < 128; q++) layer.table[q + 128] = out.quantize(activate(d.act, pre.dequantize(q)));
+        mlp.layers.push_back(std::move(layer));
+        mlp.activations.push_back(out);
+    }
+    return mlp;
+}
+
+QuantReport compare_quantized(
+    Graph& graph, const std::vector<Node*>& inputs, const std::vector<Node*>& outputs,
+    const QuantizedMlp& mlp, const fp_t* values, size_t n, const fp_t* labels
+) {
+    assert(mlp.n_inputs() == inputs.size() && mlp.n_outputs() == outputs.size());
+    QuantReport report;
+    if (n == 0) return report;
+    const size_t m = outputs.size();
+    std::vector<fp_t> expected(n * m), actual(n * m);
+    graph.predict(inputs, values, n, outputs, expected.data());
+    mlp.predict(values, n, actual.data());
+    auto predicted_class = [m](const fp_t* y) -> size_t {
+        if (m == 1) return y[0] > 0.5;
+        return std::max_element(y, y + m) - y;
+    };
+    size_t same = 0, fp_correct = 0, int8_correct = 0;
+    for (size_t r = 0; r < n; r++) {
+        for (size_t o = 0; o < m; o++) {
+            fp_t error = std::abs(expected[r * m + o] - actual[r * m + o]);
+            report.max_abs_error = std::max(report.max_abs_error, error);
+            report.mean_abs_error += error;
+        }
+        size_t c_fp = predicted_class(&expected[r * m]), c_int8 = predicted_class(&actual[r * m]);
+        same += c_fp == c_int8;
+        if (labels != nullptr) {
+            fp_correct += c_fp == (size_t)labels[r];
+            int8_correct += c_int8 == (size_t)labels[r];
+        }
+    }
+    report.mean_abs_error /= n * m;
+    report.agreement = (fp_t)same / n;
+    report.fp_accuracy = (fp_t)fp_correct / n;
+    report.int8_accuracy = (fp_t)int8_correct / n;
+    return report;
+}
+
+}
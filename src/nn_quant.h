@@ -0,0 +1,76 @@
+/* Post-training int8 quantization of MLPs built from linear_layer and activations */
+#pragma once
+#include "nn.h"
+#include <cstdint>
+#include <vector>
+
+namespace nn {
+
+// real value = scale * (q - zero), q in [-128, 127]
+struct QuantParams {
+    fp_t scale = 1;
+    int32_t zero = 0;
+
+    // covers [lo, hi] and represents 0 exactly
+    static QuantParams from_range(fp_t lo, fp_t hi);
+    int8_t quantize(fp_t v) const;
+    fp_t dequantize(int8_t q) const { return scale * (q - zero); }
+};
+
+// A dense layer followed by its activation, in integers only:
+// acc[o] = bias[o] + sum_i weight[o][i] * x[i] is requantized to the int8
+// pre-activation with a fixed-point multiplier, and a 256-entry table
+// applies the activation and the output quantization in one lookup.
+struct QuantizedLayer {
+    size_t n_in = 0, n_out = 0;
+    std::vector<int8_t> weight;         // [n_out][n_in], per output channel scales
+    std::vector<int32_t> bias;          // in accumulator units, includes the input zero point
+    std::vector<int32_t> multiplier;    // acc -> pre-activation: (acc * multiplier[o]) >> shift[o]
+    std::vector<int> shift;
+    int32_t pre_zero = 0;
+    int8_t table[256];                  // pre-activation q + 128 -> output q
+};
+
+struct QuantizedMlp {
+    QuantParams input;                  // per tensor, for the first layer
+    std::vector<QuantParams> activations; // output of each layer
+    std::vector<QuantizedLayer> layers;
+
+    size_t n_inputs() const { return layers.empty() ? 0 : layers.front().n_in; }
+    size_t n_outputs() const { return layers.empty() ? 0 : layers.back().n_out; }
+    size_t weight_bytes() const;
+    // row-major inputs [n][n_inputs()] to outputs [n][n_outputs()], like Graph::predict
+    void predict(const fp_t* inputs, size_t n, fp_t* outputs) const;
+};
+
+// Finds the dense layers between `inputs` and `outputs`: every layer node is
+// an optional Relu/Sigmoid/Tanh of a sum of weight * input products plus an
+// optional bias, as built by linear_layer (with_bias) and activation_layer.
+// A bias is a leaf that is neither one of `inputs` nor a weight of any product.
+// Weights get one symmetric scale per output channel from their current
+// values; activation ranges are calibrated per tensor by evaluating the graph
+// on `n` rows of sample inputs (row-major [n][inputs.size()]).
+// Throws std::runtime_error if the graph is not such an MLP.
+QuantizedMlp quantize_mlp(
+    Graph& graph, const std::vector<Node*>& inputs, const std::vector<Node*>& outputs,
+    const fp_t* calibration, size_t n
+);
+
+// Quantized against float outputs on the same inputs
+struct QuantReport {
+    fp_t max_abs_error = 0;
+    fp_t mean_abs_error = 0;
+    fp_t agreement = 0;                 // fraction of rows predicting the same class
+    fp_t fp_accuracy = 0;               // against `labels`, if given
+    fp_t int8_accuracy = 0;
+    fp_t accuracy_delta() const { return int8_accuracy - fp_accuracy; }
+};
+
+// The class of a row is argmax of the outputs, or output > 0.5 for a single
+// output; labels[i] is the class of row i
+QuantReport compare_quantized(
+    Graph& graph, const std::vector<Node*>& inputs, const std::vector<Node*>& outputs,
+    const QuantizedMlp& mlp, const fp_t* values, size_t n, const fp_t* labels = nullptr
+);
+
+}
@@ -0,0 +1,154 @@
+#include "nn_shm.h"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nn {
+
+namespace {
+const uint64_t MAGIC = 0x6d67726164736d31;     // "mgradsm1"
+const auto ATTACH_TIMEOUT = std::chrono::seconds(60);
+
+std::runtime_error shm_error(std::string what, std::string name) {
+    return std::runtime_error(what + " '" + name + "': " + std::strerror(errno));
+}
+
+void backoff(size_t& spins) {
+    spins++;
+    if (spins < 64) return;
+    if (spins < 256) { std::this_thread::yield(); return; }
+    std::this_thread::sleep_for(std::chrono::microseconds(20));
+}
+
+// 64-byte multiples keep every counter and buffer on its own cache lines
+size_t round_up(size_t n) { return (n + 63) / 64 * 64; }
+}
+
+// atomics in the segment are lock-free, hence address-free: they work across processes
+struct ShmGroup::Header {
+    std::atomic<uint64_t> magic;
+    std::atomic<uint64_t> attached;
+    uint64_t n_ranks;
+    uint64_t capacity;
+};
+struct alignas(64) ShmGroup::Counter {
+    std::atomic<uint64_t> step;
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared counters must be lock-free");
+
+ShmGroup::ShmGroup(std::string name, size_t rank, size_t n_ranks, size_t capacity):
+    rank(rank), n_ranks(n_ranks), capacity(round_up(capacity * sizeof(fp_t)) / sizeof(fp_t)) {
+    assert(rank < n_ranks);
+    const size_t header_bytes = round_up(sizeof(Header));
+    const size_t counter_bytes = n_ranks * sizeof(Counter);
+    const size_t buffer_bytes = this->capacity * sizeof(fp_t);
+    n_bytes = header_bytes + 2 * counter_bytes + (n_ranks + 2) * buffer_bytes;
+
+    const auto deadline = std::chrono::steady_clock::now() + ATTACH_TIMEOUT;
+    auto wait = [&](size_t& spins) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            errno = ETIMEDOUT;
+            throw shm_error("timed out waiting for the other ranks of", name);
+        }
+        backoff(spins);
+    };
+
+    int fd;
+    size_t spins = 0;
+    if (rank == 0) {
+        fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) throw shm_error("cannot create shared memory", name);
+        if (ftruncate(fd, n_bytes) != 0) { close(fd); shm_unlink(name.c_str()); throw shm_error("cannot size", name); }
+    } else {
+        // rank 0 may not have created and sized the segment yet
+        while ((fd = shm_open(name.c_str(), O_RDWR, 0600)) < 0) {
+            if (errno != ENOENT) throw shm_error("cannot open shared memory", name);
+            wait(spins);
+        }
+        struct stat st;
+        while (fstat(fd, &st) == 0 && (size_t)st.st_size < n_bytes) { wait(spins); }
+    }
+    void* data = mmap(nullptr, n_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        if (rank == 0) shm_unlink(name.c_str());
+        throw shm_error("cannot map shared memory", name);
+    }
+    char* bytes = (char*)data;
+    header = (Header*)bytes;
+    posted = (Counter*)(bytes + header_bytes);
+    reduced = (Counter*)(bytes + header_bytes + counter_bytes);
+    inputs = (fp_t*)(bytes + header_bytes + 2 * counter_bytes);
+    outputs = inputs + n_ranks * this->capacity;
+
+    if (rank == 0) {
+        new (&header->attached) std::atomic<uint64_t>(0);
+        header->n_ranks = n_ranks;
+        header->capacity = this->capacity;
+        for (size_t r = 0; r < n_ranks; r++) {
+            new (&posted[r]) Counter{{0}};
+            new (&reduced[r]) Counter{{0}};
+        }
+        header->magic.store(MAGIC, std::memory_order_release);
+    } else {
+        while (header->magic.load(std::memory_order_acquire) != MAGIC) { wait(spins); }
+        if (header->n_ranks != n_ranks || header->capacity != this->capacity) {
+            munmap(data, n_bytes);
+            throw std::runtime_error("shared memory '" + name + "' was created for another group size or capacity");
+        }
+    }
+    header->attached.fetch_add(1, std::memory_order_acq_rel);
+    while (header->attached.load(std::memory_order_acquire) < n_ranks) {
+        try { wait(spins); }
+        catch (...) { if (rank == 0) shm_unlink(name.c_str()); munmap(data, n_bytes); throw; }
+    }
+    if (rank == 0) shm_unlink(name.c_str());
+}
+
+ShmGroup::~ShmGroup() { munmap(header, n_bytes); }
+
+void ShmGroup::all_reduce(fp_t* data, size_t n) {
+    assert(n <= capacity);
+    step++;
+    // the previous step ended once every rank had summed its slice, so all inputs are free
+    std::copy_n(data, n, inputs + rank * capacity);
+    posted[rank].step.store(step, std::memory_order_release);
+    for (size_t r = 0; r < n_ranks; r++) {
+        size_t spins = 0;
+        while (posted[r].step.load(std::memory_order_acquire) < step) { backoff(spins); }
+    }
+
+    // sum this rank's slice; an output buffer is only reused two steps later,
+    // after every rank has copied it out
+    size_t slice = round_up((n + n_ranks - 1) / n_ranks * sizeof(fp_t)) / sizeof(fp_t);
+    size_t begin = std::min(n, rank * slice);
+    size_t end = std::min(n, begin + slice);
+    fp_t* out = outputs + (step % 2) * capacity;
+    std::copy(inputs + begin, inputs + end, out + begin);
+    for (size_t r = 1; r < n_ranks; r++) {
+        const fp_t* in = inputs + r * capacity;
+        for (size_t i = begin; i < end; i++) { out[i] += in[i]; }
+    }
+    reduced[rank].step.store(step, std::memory_order_release);
+    for (size_t r = 0; r < n_ranks; r++) {
+        size_t spins = 0;
+        while (reduced[r].step.load(std::memory_order_acquire) < step) { backoff(spins); }
+    }
+    std::copy_n(out, n, data);
+}
+
+void ShmGroup::broadcast(fp_t* data, size_t n, size_t root) {
+    assert(root < n_ranks);
+    if (rank != root) std::fill_n(data, n, 0);
+    all_reduce(data, n);
+}
+
+}
@@ -0,0 +1,48 @@
+/* Data-parallel training between processes of one host through POSIX shared memory */
+#pragma once
+#include "nn.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace nn {
+
+// n_ranks processes exchanging vectors of at most `capacity` values through
+// a shared-memory segment. Every rank constructs the group with the same
+// name, size and capacity, rank 0 creates the segment and removes its name
+// once all ranks are attached, so nothing is left behind in /dev/shm.
+// Collectives are sequenced by per-rank step counters in the segment,
+// ranks wait for each other by polling them (spin, then yield), without locks.
+// All ranks must call the same collectives in the same order.
+struct ShmGroup {
+    ShmGroup(std::string name, size_t rank, size_t n_ranks, size_t capacity);
+    ~ShmGroup();
+
+    const size_t rank;
+    const size_t n_ranks;
+    const size_t capacity;
+
+    // data = sum of data over the ranks. Each rank sums one slice of the
+    // vectors in rank order, then every rank copies all slices: the result
+    // is identical on all ranks and does not depend on timing
+    void all_reduce(fp_t* data, size_t n);
+    // data = data of rank `root`
+    void broadcast(fp_t* data, size_t n, size_t root = 0);
+    // returns when every rank has called it
+    void barrier() { all_reduce(nullptr, 0); }
+
+private:
+    struct Header;
+    struct Counter;
+    Header* header = nullptr;
+    Counter* posted = nullptr;      // [n_ranks], last step whose input the rank has written
+    Counter* reduced = nullptr;     // [n_ranks], last step whose slice the rank has summed
+    fp_t* inputs = nullptr;         // [n_ranks][capacity], written by their rank
+    fp_t* outputs = nullptr;        // [2][capacity], by step parity
+    size_t n_bytes = 0;
+    uint64_t step = 0;
+    ShmGroup(const ShmGroup&) = delete;
+    ShmGroup& operator=(const ShmGroup&) = delete;
+};
+
+}
@@ -0,0 +1,134 @@
+#include "nn_sparse.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
+namespace nn {
+
+fp_t SparseMatrix::at(size_t i, size_t j) const {
+    assert(i < n_rows && j < n_cols);
+    auto begin = col.begin() + row_ptr[i], end = col.begin() + row_ptr[i + 1];
+    auto it = std::lower_bound(begin, end, j);
+    return it != end && *it == j ? values[it - col.begin()] : 0;
+}
+
+std::vector<fp_t> SparseMatrix::dense() const {
+    std::vector<fp_t> result(n_rows * n_cols, 0);
+    for (size_t i = 0; i < n_rows; i++) {
+        for (size_t k = row_ptr[i]; k < row_ptr[i + 1]; k++) { result[i * n_cols + col[k]] = values[k]; }
+    }
+    return result;
+}
+
+namespace {
+
+// Greedy distance-2 coloring in the bipartite row/column graph: each row, in
+// order, takes the smallest color not used by a row sharing one of its columns.
+// Banded patterns get as many colors as the bandwidth.
+void color_rows(JacobianPattern& p) {
+    // the rows of each column
+    std::vector<size_t> col_ptr(p.n_cols + 1, 0), rows(p.nnz());
+    for (size_t j: p.col) { col_ptr[j + 1]++; }
+    for (size_t j = 0; j < p.n_cols; j++) { col_ptr[j + 1] += col_ptr[j]; }
+    std::vector<size_t> next(col_ptr.begin(), col_ptr.end() - 1);
+    for (size_t i = 0; i < p.n_rows; i++) {
+        for (size_t k = p.row_ptr[i]; k < p.row_ptr[i + 1]; k++) { rows[next[p.col[k]]++] = i; }
+    }
+
+    const size_t none = SIZE_MAX;
+    p.color.assign(p.n_rows, none);
+    p.n_colors = 0;
+    std::vector<size_t> forbidden;      // forbidden[c] == i: a neighbour of row i has color c
+    for (size_t i = 0; i < p.n_rows; i++) {
+        for (size_t k = p.row_ptr[i]; k < p.row_ptr[i + 1]; k++) {
+            size_t j = p.col[k];
+            for (size_t r = col_ptr[j]; r < col_ptr[j + 1]; r++) {
+                if (p.color[rows[r]] != none) forbidden[p.color[rows[r]]] = i;
+            }
+        }
+        size_t c = 0;
+        while (c < p.n_colors && forbidden[c] == i) c++;
+        if (c == p.n_colors) {
+            p.n_colors++;
+            forbidden.push_back(none);
+        }
+        p.color[i] = c;
+    }
+}
+
+}
+
+JacobianPattern jacobian_pattern(Graph& graph, const std::vector<Node*>& outputs, const std::vector<Node*>& wrt) {
+    JacobianPattern p;
+    p.n_rows = outputs.size();
+    p.n_cols = wrt.size();
+
+    // only the ops the outputs depend on
+    std::vector<bool> needed(graph.nodes.size(), false);
+    for (Node* node: outputs) {
+        assert(node->graph == &graph);
+        needed[node->id] = true;
+    }
+    for (size_t i = graph.ops.size(); i-- > 0;) {
+        if (!needed[graph.ops[i]->output->id]) continue;
+        for (Node* input: graph.ops[i]->inputs) { needed[input->id] = true; }
+    }
+
+    // deps[id]: the sorted columns a node depends on, propagated in graph order
+    std::vector<std::vector<size_t>> deps(graph.nodes.size());
+    for (size_t j = 0; j < wrt.size(); j++) {
+        assert(wrt[j]->graph == &graph);
+        deps[wrt[j]->id].push_back(j);
+    }
+    for (OpNode* op: graph.ops) {
+        if (!needed[op->output->id]) continue;
+        std::vector<size_t>& d = deps[op->output->id];
+        for (Node* input: op->inputs) { d.insert(d.end(), deps[input->id].begin(), deps[input->id].end()); }
+        std::sort(d.begin(), d.end());
+        d.erase(std::unique(d.begin(), d.end()), d.end());
+    }
+
+    p.row_ptr.reserve(p.n_rows + 1);
+    p.row_ptr.push_back(0);
+    for (Node* node: outputs) {
+        p.col.insert(p.col.end(), deps[node->id].begin(), deps[node->id].end());
+        p.row_ptr.push_back(p.col.size());
+    }
+    color_rows(p);
+    return p;
+}
+
+SparseMatrix sparse_jacobian(
+    Graph& graph, const std::vector<Node*>& outputs, const std::vector<Node*>& wrt,
+    const JacobianPattern& pattern
+) {
+    assert(pattern.n_rows == outputs.size() && pattern.n_cols == wrt.size());
+    SparseMatrix J;
+    J.n_rows = pattern.n_rows;
+    J.n_cols = pattern.n_cols;
+    J.row_ptr = pattern.row_ptr;
+    J.col = pattern.col;
+    J.values.assign(pattern.nnz(), 0);
+    if (pattern.n_colors == 0) return J;
+
+    // lane c: adjoints of the sum of the outputs of color c; their rows have
+    // disjoint columns, so each gradient lane holds entries of a single row
+    Batch lanes = graph.batch(pattern.n_colors);
+    for (size_t i = 0; i < outputs.size(); i++) {
+        assert(outputs[i]->graph == &graph);
+        lanes.grad(outputs[i])[pattern.color[i]] += 1;
+    }
+    graph.backward(lanes);
+    for (size_t i = 0; i < J.n_rows; i++) {
+        for (size_t k = J.row_ptr[i]; k < J.row_ptr[i + 1]; k++) {
+            J.values[k] = lanes.grad(wrt[J.col[k]])[pattern.color[i]];
+        }
+    }
+    return J;
+}
+
+SparseMatrix sparse_jacobian(Graph& graph, const std::vector<Node*>& outputs, const std::vector<Node*>& wrt) {
+    return sparse_jacobian(graph, outputs, wrt, jacobian_pattern(graph, outputs, wrt));
+}
+
+}
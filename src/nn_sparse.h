@@ -0,0 +1,48 @@
+/* Sparse Jacobians: structural pattern, row coloring and compressed reverse sweeps */
+#pragma once
+#include "nn.h"
+#include <vector>
+
+namespace nn {
+
+// Compressed sparse rows: the columns of row i are col[row_ptr[i] .. row_ptr[i + 1]),
+// sorted, with their entries in values
+struct SparseMatrix {
+    size_t n_rows = 0, n_cols = 0;
+    std::vector<size_t> row_ptr;
+    std::vector<size_t> col;
+    std::vector<fp_t> values;
+
+    size_t nnz() const { return col.size(); }
+    fp_t at(size_t i, size_t j) const;      // 0 outside the pattern
+    std::vector<fp_t> dense() const;        // row-major [n_rows][n_cols]
+};
+
+// The entries of d outputs / d wrt that are not structurally zero, in CSR
+// form, and a coloring of the rows: rows of the same color share no column,
+// so one reverse sweep seeded on all of them recovers each of their rows.
+struct JacobianPattern {
+    size_t n_rows = 0, n_cols = 0;
+    std::vector<size_t> row_ptr;
+    std::vector<size_t> col;
+    std::vector<size_t> color;              // of each row, in [0, n_colors)
+    size_t n_colors = 0;
+
+    size_t nnz() const { return col.size(); }
+};
+
+// Follows the op dependencies from `wrt` to `outputs` (an entry is in the
+// pattern if there is a path, whatever the node values) and colors the rows
+// greedily in the distance-2 sense. Depends only on the graph structure,
+// so it can be reused at every point.
+JacobianPattern jacobian_pattern(Graph& graph, const std::vector<Node*>& outputs, const std::vector<Node*>& wrt);
+
+// The Jacobian at the current node values (call forward() first) in one
+// reverse sweep over a Batch of pattern.n_colors lanes, instead of a lane per output
+SparseMatrix sparse_jacobian(
+    Graph& graph, const std::vector<Node*>& outputs, const std::vector<Node*>& wrt,
+    const JacobianPattern& pattern
+);
+SparseMatrix sparse_jacobian(Graph& graph, const std::vector<Node*>& outputs, const std::vector<Node*>& wrt);
+
+}
@@ -0,0 +1,121 @@
+#include "nn.h"
+#include "nn_blocks.h"
+#include "nn_kernels.h"
+#include "nn_quant.h"
+#include <iostream>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+using namespace nn;
+
+void check(bool ok, std::string what) {
+    if (!ok) {
+        std::cout << "[Error] assertion failed: " << what << std::endl;
+        exit(1);
+    }
+}
+
+std::vector<fp_t> random_inputs(size_t n, size_t width, unsigned seed) {
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<fp_t> dist(-3, 3);
+    std::vector<fp_t> v(n * width);
+    for (auto& x: v) x = dist(gen);
+    return v;
+}
+
+void test_params() {
+    QuantParams p = QuantParams::from_range(-1, 3);
+    check(p.dequantize(p.quantize(0)) == 0, "zero is exact");
+    check(std::abs(p.dequantize(p.quantize(1.234)) - 1.234) <= p.scale / 2, "rounding error");
+    check(p.quantize(100) == 127 && p.quantize(-100) == -128, "saturation");
+    QuantParams positive = QuantParams::from_range(0.5, 2);
+    check(positive.quantize(0) == -128 && positive.quantize(2) == 127, "the range includes 0");
+}
+
+// the classifier of demo_mlp, with random weights
+void test_mlp() {
+    Graph g;
+    auto x = g.variable(0, "x");
+    auto y = g.variable(0, "y");
+    Node* input[2] = {x.ptr, y.ptr};
+    auto l1 = linear_layer<2, 16>(g, input).with_bias().normal_init(0, 1) << ActivationType::Tanh;
+    auto l2 = linear_layer<16, 8>(g, l1.output).with_bias().normal_init(0, 0.5) << ActivationType::Relu;
+    auto l3 = linear_layer<8, 1>(g, l2.output).with_bias().normal_init(0, 0.5) << ActivationType::Sigmoid;
+    std::vector<Node*> inputs = {x.ptr, y.ptr}, outputs = {l3.output[0]};
+
+    const size_t n = 2000;
+    std::vector<fp_t> calibration = random_inputs(n, 2, 1);
+    QuantizedMlp mlp = quantize_mlp(g, inputs, outputs, calibration.data(), n);
+    check(mlp.layers.size() == 3 && mlp.n_inputs() == 2 && mlp.n_outputs() == 1, "three layers found");
+    check(mlp.layers[1].n_in == 16 && mlp.layers[1].n_out == 8, "layer shapes");
+    check(mlp.layers[0].weight.size() == 32 && mlp.layers[2].weight.size() == 8, "one byte per weight");
+
+    std::vector<fp_t> test = random_inputs(n, 2, 2);
+    std::vector<fp_t> labels(n);
+    for (size_t i = 0; i < n; i++) labels[i] = test[2 * i] * test[2 * i + 1] > 0;
+    QuantReport report = compare_quantized(g, inputs, outputs, mlp, test.data(), n, labels.data());
+    check(report.max_abs_error < 0.05, "outputs close to the float graph");
+    check(report.mean_abs_error < 0.01, "small mean error");
+    check(report.agreement > 0.97, "same classes");
+    check(std::abs(report.accuracy_delta()) < 0.03, "accuracy delta");
+
+    // every instruction set gives the same integers
+    std::vector<fp_t> reference(n), other(n);
+    SimdLevel level = simd_level();
+    mlp.predict(test.data(), n, reference.data());
+    for (SimdLevel l: {SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512}) {
+        if (!simd_supported(l)) continue;
+        set_simd_level(l);
+        mlp.predict(test.data(), n, other.data());
+        check(other == reference, "identical across SIMD levels");
+    }
+    set_simd_level(level);
+}
+
+// without activation and with several outputs; inputs used in another order than given
+void test_linear() {
+    Graph g;
+    auto a = g.variable(0, "a");
+    auto b = g.variable(0, "b");
+    auto c = g.variable(0, "c");
+    Node* input[3] = {c.ptr, a.ptr, b.ptr};
+    auto l = linear_layer<3, 4>(g, input).with_bias().normal_init(0, 1);
+    std::vector<Node*> inputs = {a.ptr, b.ptr, c.ptr};
+    std::vector<Node*> outputs(l.output, l.output + 4);
+    std::vector<fp_t> calibration = random_inputs(500, 3, 3);
+    QuantizedMlp mlp = quantize_mlp(g, inputs, outputs, calibration.data(), 500);
+    QuantReport report = compare_quantized(g, inputs, outputs, mlp, calibration.data(), 500);
+    fp_t range = 0;
+    for (Node* w: g.nodes) if (w->op == nullptr) range = std::max(range, std::abs(w->value));
+    check(report.max_abs_error < 0.05 * range * 3, "affine layer");
+    check(report.agreement > 0.95, "argmax classes");
+}
+
+void test_not_mlp() {
+    Graph g;
+    auto x = g.variable(0, "x");
+    auto y = (x * x).sin();
+    std::vector<fp_t> calibration = {0, 1};
+    bool thrown = false;
+    try { quantize_mlp(g, {x.ptr}, {y.ptr}, calibration.data(), 2); } catch (const std::runtime_error&) { thrown = true; }
+    check(thrown, "only dense layers can be quantized");
+
+    // leaves added to the sum are biases only if they are not inputs or weights
+    auto w = g.variable(0.5, "w");
+    for (auto z: {w * x + x, w * x + w}) {
+        thrown = false;
+        try { quantize_mlp(g, {x.ptr}, {z.ptr}, calibration.data(), 2); } catch (const std::runtime_error&) { thrown = true; }
+        check(thrown, "inputs and weights are not folded into the bias");
+    }
+}
+
+int main(){
+    test_params();
+    test_mlp();
+    test_linear();
+    test_not_mlp();
+    std::cout << "Test passed." << std::endl;
+    return 0;
+}
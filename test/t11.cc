@@ -0,0 +1,168 @@
+#include "nn.h"
+#include "nn_blocks.h"
+#include "nn_kernels.h"
+#include <iostream>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace nn;
+
+void check(bool ok, std::string what) {
+    if (!ok) {
+        std::cout << "[Error] assertion failed: " << what << std::endl;
+        exit(1);
+    }
+}
+
+bool close(fp_t a, fp_t b, fp_t tol = 1e-12) { return std::abs(a - b) <= tol * (1 + std::abs(b)); }
+
+std::vector<Node*> vars(Graph& g, std::vector<fp_t> values) {
+    std::vector<Node*> nodes;
+    for (fp_t v: values) nodes.push_back(g.create_var(v));
+    return nodes;
+}
+
+void test_softmax() {
+    Graph g;
+    auto x = vars(g, {1, 2, 3, -1});
+    auto big = vars(g, {1001, 1002, 1003, 999});
+    auto p = g.softmax(x), p_big = g.softmax(big), log_p = g.log_softmax(x);
+    Node* lse_small = g.logsumexp(vars(g, {-1000, -1001}));
+    g.forward();
+    fp_t sum = 0, z = std::exp(1.) + std::exp(2.) + std::exp(3.) + std::exp(-1.);
+    for (size_t i = 0; i < 4; i++) {
+        sum += p[i]->value;
+        check(close(p[i]->value, std::exp(x[i]->value) / z), "softmax values");
+        check(close(p_big[i]->value, p[i]->value, 1e-9), "large logits do not overflow");
+        check(close(log_p[i]->value, x[i]->value - std::log(z)), "log-softmax values");
+    }
+    check(close(sum, 1), "probabilities sum to 1");
+    check(close(lse_small->value, -1000 + std::log1p(std::exp(-1.))), "small logits do not underflow");
+
+    // ∂p_0/∂x_j = p_0 (δ_0j - p_j)
+    g.clear_grad();
+    g.backward(p[0]);
+    for (size_t j = 0; j < 4; j++) {
+        check(close(x[j]->grad, p[0]->value * ((j == 0) - p[j]->value)), "softmax gradient");
+    }
+}
+
+void test_cross_entropy() {
+    Graph g;
+    auto x = vars(g, {0.3, -1.2, 2.5, 0.7, 40});
+    auto y = vars(g, {0, 0.25, 0.75, 0, 0});
+    Node* loss = g.softmax_cross_entropy(x, y);
+    check(g.nodes.size() == 11, "one node for the loss");
+    g.forward();
+    fp_t lse = std::log(std::exp(0.3) + std::exp(-1.2) + std::exp(2.5) + std::exp(0.7) + std::exp(40.));
+    check(close(loss->value, 0.25 * (lse + 1.2) + 0.75 * (lse - 2.5)), "loss value");
+    g.backward(loss);
+    for (size_t i = 0; i < 5; i++) {
+        check(close(x[i]->grad, std::exp(x[i]->value - lse) - y[i]->value), "logit gradient is p - y");
+        check(close(y[i]->grad, lse - x[i]->value), "target gradient is -log p");
+    }
+
+    // batched evaluation equals the scalar one, exactly in Exact mode
+    for (MathMode mode: {MathMode::Exact, MathMode::Fast}) {
+        g.math_mode = mode;
+        Batch batch = g.batch(7);
+        for (size_t k = 0; k < 7; k++) batch.value(x[1])[k] = -1.2 + 100 * k;
+        g.forward(batch);
+        g.backward(batch, loss);
+        fp_t tol = mode == MathMode::Exact ? 0 : 1e-12;
+        for (size_t k = 0; k < 7; k++) {
+            x[1]->value = -1.2 + 100 * k;
+            g.forward();
+            g.clear_grad();
+            g.backward(loss);
+            check(std::abs(batch.value(loss)[k] - loss->value) <= tol * (1 + std::abs(loss->value)), "batch loss");
+            for (size_t i = 0; i < 5; i++) {
+                check(std::abs(batch.grad(x[i])[k] - x[i]->grad) <= tol * (1 + std::abs(x[i]->grad)), "batch logit gradients");
+                check(std::abs(batch.grad(y[i])[k] - y[i]->grad) <= tol * (1 + std::abs(y[i]->grad)), "batch target gradients");
+            }
+        }
+        x[1]->value = -1.2;
+    }
+
+    // the lane kernels give the same bits on every instruction set
+    g.math_mode = MathMode::Fast;
+    Batch batch = g.batch(19);
+    for (size_t k = 0; k < 19; k++) batch.value(x[1])[k] = -1.2 + 3 * k;
+    auto run = [&]() {
+        g.forward(batch);
+        batch.clear_grad();
+        g.backward(batch, loss);
+        std::vector<fp_t> result(batch.value(loss), batch.value(loss) + 19);
+        for (size_t i = 0; i < 5; i++) {
+            result.insert(result.end(), batch.grad(x[i]), batch.grad(x[i]) + 19);
+            result.insert(result.end(), batch.grad(y[i]), batch.grad(y[i]) + 19);
+        }
+        return result;
+    };
+    SimdLevel level = simd_level();
+    std::vector<fp_t> reference = run();
+    for (SimdLevel l: {SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512}) {
+        if (!simd_supported(l)) continue;
+        set_simd_level(l);
+        check(run() == reference, "identical across SIMD levels");
+    }
+    set_simd_level(level);
+}
+
+// 3 classes: the sector of the angle of (a, b)
+void test_training() {
+    Graph g;
+    auto a = g.variable(0, "a");
+    auto b = g.variable(0, "b");
+    Node* input[2] = {a.ptr, b.ptr};
+    Node* target[3] = {g.create_var(0, "t0"), g.create_var(0, "t1"), g.create_var(0, "t2")};
+    auto hidden = linear_layer<2, 16>(g, input).with_bias().normal_init(0, 1) << ActivationType::Tanh;
+    auto logits = linear_layer<16, 3>(g, hidden.output).with_bias().normal_init(0, 0.3);
+    Node* loss = logits.softmax_cross_entropy(target);
+    auto probabilities = activation_layer<3>(g, logits.output, ActivationType::Softmax);
+
+    std::vector<Node*> params;
+    for (Node* node: g.nodes) {
+        if (node->op == nullptr && node != a.ptr && node != b.ptr && node->name[0] != 't') params.push_back(node);
+    }
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<fp_t> dist(-1, 1);
+    auto label = [](fp_t u, fp_t v) { return size_t(std::atan2(v, u) / (2 * M_PI / 3) + 1.5) % 3; };
+    const size_t lanes = 32;
+    Batch batch = g.batch(lanes);
+    for (size_t step = 0; step < 1500; step++) {
+        for (size_t k = 0; k < lanes; k++) {
+            fp_t u = dist(gen), v = dist(gen);
+            batch.value(a.ptr)[k] = u;
+            batch.value(b.ptr)[k] = v;
+            for (size_t c = 0; c < 3; c++) batch.value(target[c])[k] = c == label(u, v);
+        }
+        g.forward(batch);
+        batch.clear_grad();
+        g.backward(batch, loss);
+        for (Node* p: params) {
+            p->value -= 0.5 * batch.grad_sum(p) / lanes;
+            batch.fill(p, p->value);
+        }
+    }
+    size_t correct = 0, n = 1000;
+    for (size_t i = 0; i < n; i++) {
+        fp_t u = dist(gen), v = dist(gen);
+        a.set_value(u);
+        b.set_value(v);
+        g.forward();
+        size_t best = 0;
+        for (size_t c = 1; c < 3; c++) if (probabilities.output[c]->value > probabilities.output[best]->value) best = c;
+        correct += best == label(u, v);
+    }
+    check(correct > 0.9 * n, "3-class classifier learns");
+}
+
+int main(){
+    test_softmax();
+    test_cross_entropy();
+    test_training();
+    std::cout << "Test passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include "nn.h"
+#include "nn_sparse.h"
+#include <iostream>
+#include <cmath>
+#include <vector>
+
+using namespace nn;
+
+void check(bool ok, std::string what) {
+    if (!ok) {
+        std::cout << "[Error] assertion failed: " << what << std::endl;
+        exit(1);
+    }
+}
+
+// every entry of the dense Jacobian is in the pattern and has the same value
+void check_against_dense(Graph& g, const std::vector<Node*>& outputs, const std::vector<Node*>& wrt, const SparseMatrix& J) {
+    std::vector<fp_t> dense = g.jacobian(outputs, wrt);
+    check(J.dense() == dense, "same Jacobian as the dense one");
+    for (size_t i = 0; i < J.n_rows; i++) {
+        for (size_t j = 0; j < J.n_cols; j++) check(J.at(i, j) == dense[i * J.n_cols + j], "at()");
+    }
+}
+
+// Bratu problem: r_i = u_{i-1} - 2 u_i + u_{i+1} + h^2 exp(u_i), u_0 = u_{n+1} = 0
+void test_tridiagonal() {
+    const size_t n = 300;
+    Graph g;
+    std::vector<Node*> u, r;
+    for (size_t i = 0; i < n; i++) u.push_back(g.create_var(std::sin(0.1 * i)));
+    NodeProxy zero = g.constant(0), h2 = g.constant(1.0 / ((n + 1) * (n + 1)));
+    for (size_t i = 0; i < n; i++) {
+        NodeProxy left = i > 0 ? NodeProxy(u[i - 1]) : zero;
+        NodeProxy right = i + 1 < n ? NodeProxy(u[i + 1]) : zero;
+        NodeProxy ui(u[i]);
+        r.push_back((left - ui * 2 + right + h2 * ui.exp()).ptr);
+    }
+    g.forward();
+
+    JacobianPattern pattern = jacobian_pattern(g, r, u);
+    check(pattern.n_rows == n && pattern.n_cols == n, "pattern shape");
+    check(pattern.nnz() == 3 * n - 2, "tridiagonal pattern");
+    check(pattern.n_colors == 3, "three sweeps");
+    for (size_t i = 0; i < n; i++) check(pattern.color[i] == i % 3, "rows colored by their band");
+
+    SparseMatrix J = sparse_jacobian(g, r, u, pattern);
+    check(J.nnz() == 3 * n - 2, "one value per entry");
+    check(J.at(5, 4) == 1 && J.at(5, 6) == 1 && J.at(5, 7) == 0, "off-diagonal entries");
+    check(std::abs(J.at(5, 5) - (-2 + std::exp(u[5]->value) / ((n + 1) * (n + 1)))) < 1e-15, "diagonal entry");
+    check_against_dense(g, r, u, J);
+
+    // the pattern does not depend on the point
+    for (size_t i = 0; i < n; i++) u[i]->value = std::cos(0.3 * i);
+    g.forward();
+    check_against_dense(g, r, u, sparse_jacobian(g, r, u, pattern));
+}
+
+// 5-point stencil on a grid, each residual depends on 5 unknowns
+void test_grid() {
+    const size_t w = 20;
+    Graph g;
+    std::vector<Node*> u, r;
+    for (size_t i = 0; i < w * w; i++) u.push_back(g.create_var(0.01 * i));
+    for (size_t y = 0; y < w; y++) {
+        for (size_t x = 0; x < w; x++) {
+            NodeProxy c(u[y * w + x]);
+            NodeProxy sum = c.sin() * -4;
+            if (x > 0) sum = sum + NodeProxy(u[y * w + x - 1]);
+            if (x + 1 < w) sum = sum + NodeProxy(u[y * w + x + 1]);
+            if (y > 0) sum = sum + NodeProxy(u[(y - 1) * w + x]);
+            if (y + 1 < w) sum = sum + NodeProxy(u[(y + 1) * w + x]) * c;
+            r.push_back(sum.ptr);
+        }
+    }
+    g.forward();
+    JacobianPattern pattern = jacobian_pattern(g, r, u);
+    check(pattern.nnz() == 5 * w * w - 4 * w, "five entries per inner row");
+    // a row shares columns with at most 12 others
+    check(pattern.n_colors <= 13, "a few sweeps for 400 rows");
+    for (size_t i = 0; i < pattern.n_rows; i++) {
+        for (size_t j = i + 1; j < pattern.n_rows; j++) {
+            if (pattern.color[i] != pattern.color[j]) continue;
+            for (size_t k = pattern.row_ptr[i]; k < pattern.row_ptr[i + 1]; k++) {
+                for (size_t l = pattern.row_ptr[j]; l < pattern.row_ptr[j + 1]; l++) {
+                    check(pattern.col[k] != pattern.col[l], "rows of one color share no column");
+                }
+            }
+        }
+    }
+    check_against_dense(g, r, u, sparse_jacobian(g, r, u, pattern));
+}
+
+// empty rows and columns, repeated outputs, an intermediate node in wrt, an output in wrt
+void test_corners() {
+    Graph g;
+    auto a = g.variable(1.5, "a");
+    auto b = g.variable(-0.5, "b");
+    auto unused = g.variable(2, "unused");
+    auto k = g.constant(3, "k");
+    auto ab = a * b;
+    auto y0 = ab.sin() + a;
+    auto y1 = k * k;
+    auto y2 = ab.tanh() * b;
+    std::vector<Node*> outputs = {y0.ptr, y1.ptr, y2.ptr, y0.ptr, b.ptr};
+    std::vector<Node*> wrt = {a.ptr, unused.ptr, b.ptr, ab.ptr};
+    g.forward();
+    JacobianPattern pattern = jacobian_pattern(g, outputs, wrt);
+    check(pattern.row_ptr[2] - pattern.row_ptr[1] == 0, "constant output: empty row");
+    for (size_t col: pattern.col) check(col != 1, "unused variable: empty column");
+    check(pattern.row_ptr[5] - pattern.row_ptr[4] == 1, "an input depends on itself");
+    check(pattern.color[0] != pattern.color[3], "a repeated output needs its own sweep");
+    check_against_dense(g, outputs, wrt, sparse_jacobian(g, outputs, wrt, pattern));
+
+    check(jacobian_pattern(g, {}, wrt).n_colors == 0, "no outputs");
+    check(sparse_jacobian(g, {}, wrt).nnz() == 0, "empty Jacobian");
+}
+
+int main(){
+    test_tridiagonal();
+    test_grid();
+    test_corners();
+    std::cout << "Test passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include "nn.h"
+#include "nn_blocks.h"
+#include <iostream>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+using namespace nn;
+
+void check(bool ok, std::string what) {
+    if (!ok) {
+        std::cout << "[Error] assertion failed: " << what << std::endl;
+        exit(1);
+    }
+}
+
+const size_t N_TOWERS = 16;
+
+// a small MLP on the shared inputs, its weights depend on `tower` only
+Node* tower(Graph& g, Node* input[2], size_t tower) {
+    auto l1 = linear_layer<2, 8>(g, input, "tower" + std::to_string(tower)).with_bias() << ActivationType::Tanh;
+    auto l2 = linear_layer<8, 1>(g, l1.output).with_bias();
+    size_t k = 0;
+    for (Node* node: g.nodes) {
+        if (node->op == nullptr) node->value = std::sin(tower * 100 + k++);
+    }
+    return l2.output[0];
+}
+
+void check_structure(Graph& g) {
+    for (size_t i = 0; i < g.nodes.size(); i++) {
+        check(g.nodes[i]->id == i && g.nodes[i]->graph == &g, "ids and graph pointers are renumbered");
+    }
+    for (OpNode* op: g.ops) {
+        for (Node* input: op->inputs) check(input->id < op->output->id, "topological order");
+    }
+}
+
+std::vector<fp_t> evaluate(Graph& g, Node* x, Node* y, Node* out, std::vector<fp_t>* grads) {
+    std::vector<fp_t> result;
+    for (fp_t v: {-1.0, 0.25, 2.0}) {
+        x->value = v;
+        y->value = 1 - v;
+        g.forward();
+        g.clear_grad();
+        g.backward(out);
+        result.push_back(out->value);
+    }
+    grads->clear();
+    for (Node* node: g.nodes) grads->push_back(node->grad);
+    return result;
+}
+
+void test_build_parallel() {
+    // reference: built sequentially, each tower in a segment graph on this thread
+    Graph seq;
+    Node* sx = seq.create_var(0, "x");
+    Node* sy = seq.create_var(0, "y");
+    Node* sin[2] = {sx, sy};
+    std::vector<Node*> souts;
+    for (size_t t = 0; t < N_TOWERS; t++) {
+        Graph segment;
+        souts.push_back(tower(segment, sin, t));
+        seq.splice(segment);
+        check(segment.nodes.empty() && segment.ops.empty(), "the segment is emptied");
+    }
+    Node* sout = seq.logsumexp(souts);
+    check_structure(seq);
+
+    for (size_t n_threads: {1, 4, 0}) {
+        Graph g;
+        Node* x = g.create_var(0, "x");
+        Node* y = g.create_var(0, "y");
+        Node* input[2] = {x, y};
+        std::vector<Node*> outs(N_TOWERS);
+        g.build_parallel(N_TOWERS, [&](Graph& segment, size_t t) { outs[t] = tower(segment, input, t); }, n_threads);
+        Node* out = g.logsumexp(outs);
+        check_structure(g);
+        check(g.nodes.size() == seq.nodes.size() && g.ops.size() == seq.ops.size(), "same size");
+        for (size_t i = 0; i < g.nodes.size(); i++) {
+            check(g.nodes[i]->name == seq.nodes[i]->name, "same order whatever the scheduling");
+        }
+
+        std::vector<fp_t> grads, seq_grads;
+        check(evaluate(g, x, y, out, &grads) == evaluate(seq, sx, sy, sout, &seq_grads), "same values");
+        check(grads == seq_grads, "same gradients");
+    }
+}
+
+// random initialization from many threads
+void test_concurrent_init() {
+    Graph g;
+    Node* x = g.create_var(1, "x");
+    Node* input[1] = {x};
+    std::vector<Node*> outs(64);
+    g.build_parallel(64, [&](Graph& segment, size_t t) {
+        auto l = linear_layer<1, 32>(segment, input).with_bias().normal_init(0, 1);
+        outs[t] = l.output[0];
+    }, 4);
+    check_structure(g);
+    fp_t sum = 0, sum2 = 0;
+    size_t n = 0;
+    for (Node* node: g.nodes) {
+        if (node->op != nullptr || node == x) continue;
+        sum += node->value;
+        sum2 += node->value * node->value;
+        n++;
+    }
+    check(n == 64 * 64, "weights and biases");
+    check(std::abs(sum / n) < 0.1 && std::abs(sum2 / n - 1) < 0.1, "normal weights");
+    g.forward();
+    OpNode* op = outs[3]->op;
+    check(outs[3]->value == op->inputs[0]->value + op->inputs[1]->value, "evaluates");
+}
+
+// an exception in build, on a pool thread or on the calling one, reaches the caller
+void test_build_error() {
+    for (size_t n_threads: {1, 4}) {
+        Graph g;
+        Node* x = g.create_var(1, "x");
+        bool thrown = false;
+        try {
+            g.build_parallel(32, [&](Graph& segment, size_t t) {
+                segment.add(x, segment.create_var(t));
+                if (t == 9) throw std::runtime_error("segment 9");
+            }, n_threads);
+        } catch (const std::runtime_error& e) {
+            thrown = std::string(e.what()) == "segment 9";
+        }
+        check(thrown, "the exception is rethrown");
+        check(g.nodes.size() == 1 && g.ops.empty(), "the graph is left unchanged");
+    }
+}
+
+int main(){
+    test_build_parallel();
+    test_concurrent_init();
+    test_build_error();
+    std::cout << "Test passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include "../utils/bitmap.h"
+#include <iostream>
+#include <climits>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+void check(bool ok, std::string what) {
+    if (!ok) {
+        std::cout << "[Error] assertion failed: " << what << std::endl;
+        exit(1);
+    }
+}
+
+std::string temp_path(std::string name) { return "/tmp/mgrad_t14_" + std::to_string(getpid()) + "_" + name; }
+
+std::vector<unsigned char> read_file(const std::string& path) {
+    std::ifstream f(path, std::ios::binary);
+    return std::vector<unsigned char>(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+}
+
+size_t get32(const std::vector<unsigned char>& b, size_t at) {
+    return b[at] | b[at + 1] << 8 | b[at + 2] << 16 | (size_t)b[at + 3] << 24;
+}
+
+void test_layout() {
+    // 5 pixels of 3 bytes: rows padded from 15 to 16 bytes
+    std::string path = temp_path("rgb.bmp");
+    check(write_bitmap(path, 5, 3, BitmapFormat::RGB24, [](int j, unsigned char* pixels) {
+        for (int i = 0; i < 15; i++) pixels[i] = j * 15 + i;
+    }), "rgb bitmap written");
+    std::vector<unsigned char> b = read_file(path);
+    check(b.size() == 54 + 3 * 16 && get32(b, 2) == b.size(), "file size includes the row padding");
+    check(get32(b, 10) == 54 && get32(b, 18) == 5 && get32(b, 22) == 3 && b[28] == 24, "rgb header");
+    check(b[54 + 16 + 3] == 18 && b[54 + 2 * 16 + 14] == 44, "rows bottom up");
+    std::remove(path.c_str());
+
+    path = temp_path("gray.bmp");
+    check(write_bitmap(path, 2, 2, BitmapFormat::Gray8, [](int j, unsigned char* pixels) {
+        pixels[0] = j;
+        pixels[1] = 200;
+    }), "gray bitmap written");
+    b = read_file(path);
+    check(b.size() == 54 + 1024 + 2 * 4 && get32(b, 10) == 54 + 1024 && b[28] == 8, "gray header and palette");
+    check(b[54 + 1024 + 4] == 1 && b[54 + 1024 + 5] == 200, "gray pixels");
+    std::remove(path.c_str());
+}
+
+void test_invalid() {
+    std::string path = temp_path("invalid.bmp");
+    bool called = false;
+    auto row = [&called](int, unsigned char*) { called = true; };
+    check(!write_bitmap(path, 0, 10, BitmapFormat::RGB24, row), "zero width");
+    check(!write_bitmap(path, 10, 0, BitmapFormat::Gray8, row), "zero height");
+    check(!write_bitmap(path, -4, 10, BitmapFormat::RGB24, row), "negative width");
+    check(!write_bitmap(path, 10, -4, BitmapFormat::Gray8, row), "negative height");
+    check(!write_bitmap(path, 10, 10, BitmapFormat(7), row), "unknown format");
+    check(!write_bitmap(path, INT_MAX, INT_MAX, BitmapFormat::RGB24, row), "larger than the BMP header allows");
+    check(!called && access(path.c_str(), F_OK) != 0, "no file is created");
+}
+
+int main(){
+    test_layout();
+    test_invalid();
+    std::cout << "Test passed." << std::endl;
+    return 0;
+}
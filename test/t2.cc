@@ -0,0 +1,103 @@
+#include "nn.h"
+#include "nn_math.h"
+#include <iostream>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace nn;
+
+void check(bool ok, std::string what) {
+    if (!ok) {
+        std::cout << "[Error] assertion failed: " << what << std::endl;
+        exit(1);
+    }
+}
+
+// error of `a` in units in the last place of `b`
+fp_t ulp_error(fp_t a, fp_t b) {
+    if (a == b) return 0;
+    fp_t ulp = std::nextafter(std::abs(b), INFINITY) - std::abs(b);
+    return std::abs(a - b) / ulp;
+}
+
+void test_fast_math(
+    void (*fn)(const fp_t*, fp_t*, size_t, MathMode),
+    std::string name, fp_t lb, fp_t ub, fp_t max_ulp
+){
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<fp_t> dist(lb, ub);
+    std::vector<fp_t> x(10000), exact(x.size()), fast(x.size());
+    for (auto& v: x) v = dist(gen);
+    fn(x.data(), exact.data(), x.size(), MathMode::Exact);
+    fn(x.data(), fast.data(), x.size(), MathMode::Fast);
+    fp_t worst = 0;
+    for (size_t i = 0; i < x.size(); i++) worst = std::max(worst, ulp_error(fast[i], exact[i]));
+    check(worst <= max_ulp, name + " fast mode error " + std::to_string(worst) + " ulp");
+}
+
+void test_math() {
+    test_fast_math(math::exp, "exp", -700, 700, 4);
+    test_fast_math(math::exp, "exp", -1, 1, 4);
+    test_fast_math(math::log, "log", 1e-300, 1e300, 4);
+    test_fast_math(math::log, "log", 0.5, 2, 4);
+    test_fast_math(math::sin, "sin", -10, 10, 4);
+    test_fast_math(math::cos, "cos", -10, 10, 4);
+    test_fast_math(math::tanh, "tanh", -25, 25, 4);
+    test_fast_math(math::tanh, "tanh", -1e-3, 1e-3, 4);
+    test_fast_math(math::sigmoid, "sigmoid", -50, 50, 4);
+
+    // out-of-range and non-finite inputs go through libm
+    std::vector<fp_t> x = {-INFINITY, INFINITY, NAN, 0, -1, 1e-310, 800, -800, 1e10};
+    std::vector<fp_t> y(x.size());
+    math::log(x.data(), y.data(), x.size(), MathMode::Fast);
+    check(std::isnan(y[2]) && std::isinf(y[3]) && std::isnan(y[4]) && y[5] == std::log(1e-310), "log special cases");
+    math::exp(x.data(), y.data(), x.size(), MathMode::Fast);
+    check(y[0] == 0 && std::isinf(y[1]) && std::isnan(y[2]) && std::isinf(y[6]) && y[7] == 0, "exp special cases");
+    math::sin(x.data(), y.data(), x.size(), MathMode::Fast);
+    check(y[8] == std::sin(1e10), "sin special cases");
+}
+
+// batched forward and backward match the scalar path lane by lane
+void test_batch(MathMode mode, fp_t tol) {
+    Graph g;
+    g.math_mode = mode;
+    auto x = g.variable(0, "x");
+    auto y = g.variable(0, "y");
+    auto w = g.variable(0.7, "w");
+    auto z = (x * w + y).tanh() + (x.sin() * y.cos()).sigmoid() + (x.abs() + 1).log() - y.pow(2) / (w + 2);
+    z = z.max(x - 3).relu();
+
+    const size_t n = 100;
+    Batch batch = g.batch(n);
+    for (size_t i = 0; i < n; i++) {
+        batch.value(x.ptr)[i] = i * 0.1 - 5;
+        batch.value(y.ptr)[i] = 2 - i * 0.03;
+    }
+    g.forward(batch);
+    g.backward(batch, z.ptr);
+
+    fp_t w_grad = 0;
+    for (size_t i = 0; i < n; i++) {
+        x.set_value(i * 0.1 - 5);
+        y.set_value(2 - i * 0.03);
+        g.forward();
+        g.backward(z);
+        w_grad += w.grad();
+        check(std::abs(batch.value(z.ptr)[i] - z.value()) <= tol, "batched forward");
+        check(std::abs(batch.grad(x.ptr)[i] - x.grad()) <= tol, "batched backward");
+        check(std::abs(batch.grad(y.ptr)[i] - y.grad()) <= tol, "batched backward");
+        g.clear_grad();
+    }
+    fp_t batch_w_grad = 0;
+    for (size_t i = 0; i < n; i++) batch_w_grad += batch.grad(w.ptr)[i];
+    check(std::abs(batch_w_grad - w_grad) <= tol * n, "batched parameter gradient");
+}
+
+int main(){
+    test_math();
+    test_batch(MathMode::Exact, 0);
+    test_batch(MathMode::Fast, 1e-12);
+    std::cout << "Test passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include "nn.h"
+#include "nn_math.h"
+#include "nn_kernels.h"
+#include <iostream>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace nn;
+
+void check(bool ok, std::string what) {
+    if (!ok) {
+        std::cout << "[Error] assertion failed: " << what << std::endl;
+        exit(1);
+    }
+}
+
+bool same_bits(const std::vector<fp_t>& a, const std::vector<fp_t>& b) {
+    return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(fp_t)) == 0;
+}
+
+// batched fast-math forward and backward of a small graph, returns all lanes
+std::vector<fp_t> run_graph() {
+    Graph g;
+    g.math_mode = MathMode::Fast;
+    auto x = g.variable(0, "x");
+    auto y = g.variable(0, "y");
+    auto z = (x * 0.5 + y).tanh() * (x.sin() - y.cos()).sigmoid() + (x.abs() + 1).log() / (y.relu() + 1);
+    z = z.max(y * y * 0.01).pow(2) - z.min(-x);
+
+    const size_t n = 1003;          // not a multiple of any vector width
+    Batch batch = g.batch(n);
+    for (size_t i = 0; i < n; i++) {
+        batch.value(x.ptr)[i] = std::sin(i * 0.37) * 6;
+        batch.value(y.ptr)[i] = std::cos(i * 0.11) * 3;
+    }
+    g.forward(batch);
+    g.backward(batch, z.ptr);
+    std::vector<fp_t> out(batch.values);
+    out.insert(out.end(), batch.grads.begin(), batch.grads.end());
+    return out;
+}
+
+std::vector<fp_t> run_math() {
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<fp_t> dist(-30, 30);
+    std::vector<fp_t> x(4099), y, out;
+    for (auto& v: x) v = dist(gen);
+    x[7] = NAN; x[100] = 1e6; x[2000] = -INFINITY;
+    y.resize(x.size());
+    for (auto fn: {math::exp, math::log, math::sin, math::cos, math::tanh, math::sigmoid}) {
+        fn(x.data(), y.data(), x.size(), MathMode::Fast);
+        out.insert(out.end(), y.begin(), y.end());
+    }
+    return out;
+}
+
+int main(){
+    std::cout << "Selected SIMD level: " << simd_name(simd_level()) << std::endl;
+    check(simd_supported(SimdLevel::SSE2), "baseline level is always supported");
+    check(simd_supported(simd_level()), "selected level is supported");
+
+    // every level the CPU supports computes bit-identical results
+    set_simd_level(SimdLevel::SSE2);
+    auto graph_ref = run_graph();
+    auto math_ref = run_math();
+    for (SimdLevel level: {SimdLevel::AVX2, SimdLevel::AVX512}) {
+        if (!simd_supported(level)) {
+            std::cout << "Skipping unsupported level: " << simd_name(level) << std::endl;
+            continue;
+        }
+        set_simd_level(level);
+        check(same_bits(run_graph(), graph_ref), std::string("batched graph on ") + simd_name(level));
+        check(same_bits(run_math(), math_ref), std::string("math kernels on ") + simd_name(level));
+    }
+    std::cout << "Test passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include "nn.h"
+#include "nn_data.h"
+#include <iostream>
+#include <cstdio>
+#include <fstream>
+#include <set>
+#include <vector>
+#include <stdexcept>
+#include <unistd.h>
+
+using namespace nn;
+
+void check(bool ok, std::string what) {
+    if (!ok) {
+        std::cout << "[Error] assertion failed: " << what << std::endl;
+        exit(1);
+    }
+}
+
+std::string temp_path(std::string name) { return "/tmp/mgrad_t4_" + std::to_string(getpid()) + "_" + name; }
+
+// sample i is (i, 2i, 3i)
+const size_t N_SAMPLES = 103;
+
+void check_epochs(Source& source, size_t epochs, size_t batch_size, bool shuffled) {
+    DataLoader loader(source, batch_size, epochs);
+    Minibatch batch;
+    std::multiset<fp_t> seen;
+    size_t n_batches = 0;
+    bool in_order = true;
+    while (loader.next(batch)) {
+        n_batches++;
+        check(batch.width == 3, "minibatch width");
+        for (size_t i = 0; i < batch.size; i++) {
+            fp_t v = batch.at(i, 0);
+            check(batch.at(i, 1) == 2 * v && batch.at(i, 2) == 3 * v, "sample values stay together");
+            in_order &= v == (seen.size() % N_SAMPLES);
+            seen.insert(v);
+        }
+    }
+    check(seen.size() == epochs * N_SAMPLES, "every sample of every epoch");
+    check(n_batches == (epochs * N_SAMPLES + batch_size - 1) / batch_size, "epochs are concatenated into full batches");
+    for (size_t i = 0; i < N_SAMPLES; i++) check(seen.count(i) == epochs, "each sample once per epoch");
+    check(in_order != shuffled, shuffled ? "samples are shuffled" : "samples keep their order");
+}
+
+void test_sources() {
+    std::string csv = temp_path("data.csv");
+    std::string bin = temp_path("data.bin");
+    std::ofstream f(csv);
+    f << "x,y,z\n";
+    for (size_t i = 0; i < N_SAMPLES; i++) f << i << ", " << 2 * i << "," << 3 * i << "\n";
+    f.close();
+    std::FILE* b = std::fopen(bin.c_str(), "wb");
+    for (size_t i = 0; i < N_SAMPLES; i++) {
+        double row[3] = {(double)i, 2. * i, 3. * i};
+        std::fwrite(row, sizeof(double), 3, b);
+    }
+    std::fclose(b);
+
+    CsvSource csv_source(csv, true);
+    check(csv_source.width() == 3, "csv width");
+    check_epochs(csv_source, 3, 16, false);
+
+    MmapSource mmap_source(bin, 3);
+    check(mmap_source.size() == N_SAMPLES, "mmap sample count");
+    check_epochs(mmap_source, 2, 10, false);
+
+    ShuffleSource shuffled(mmap_source, 32, 0);
+    check_epochs(shuffled, 2, 7, true);
+
+    bool thrown = false;
+    try { MmapSource(bin, 5); } catch (const std::runtime_error&) { thrown = true; }
+    check(thrown, "binary file size must match the width");
+    thrown = false;
+    try { CsvSource(csv, false); } catch (const std::runtime_error&) { thrown = true; }
+    check(thrown, "csv header is not a sample");
+
+    std::remove(csv.c_str());
+    std::remove(bin.c_str());
+}
+
+void test_load() {
+    size_t i = 0;
+    GeneratorSource source(3, [&i](fp_t* s) { s[0] = i; s[1] = 2 * i; s[2] = 3 * i; i++; });
+    DataLoader loader(source, 8);
+
+    Graph g;
+    auto x = g.variable(0, "x");
+    auto y = g.variable(0, "y");
+    auto z = x * y;
+    Batch batch = g.batch(8);
+    Minibatch mb;
+    for (int step = 0; step < 5; step++) {
+        check(loader.next(mb) && mb.size == 8, "endless generator gives full batches");
+        mb.load(batch, {x.ptr, y.ptr});
+        g.forward(batch);
+        for (size_t k = 0; k < 8; k++) {
+            fp_t v = step * 8 + k;
+            check(batch.value(z.ptr)[k] == v * 2 * v, "batch loaded into input lanes");
+        }
+        mb.load(3, {x.ptr, y.ptr});
+        g.forward();
+        check(z.value() == (step * 8 + 3) * 2. * (step * 8 + 3), "sample loaded into node values");
+    }
+}
+
+// the producer thread hands the exception over to next()
+void test_malformed_csv() {
+    std::string csv = temp_path("malformed.csv");
+    std::ofstream f(csv);
+    for (size_t i = 0; i < 20; i++) f << i << "," << 2 * i << "," << 3 * i << "\n";
+    f << "20,forty,60\n";
+    for (size_t i = 21; i < 30; i++) f << i << "," << 2 * i << "," << 3 * i << "\n";
+    f.close();
+
+    CsvSource source(csv);
+    DataLoader loader(source, 8, 1);
+    Minibatch batch;
+    size_t n_batches = 0;
+    bool thrown = false;
+    try {
+        while (loader.next(batch)) n_batches++;
+    } catch (const std::runtime_error& e) {
+        thrown = std::string(e.what()).find("line 21") != std::string::npos;
+    }
+    check(thrown, "a malformed line is reported by next()");
+    check(n_batches == 2, "batches before the malformed line are delivered");
+    std::remove(csv.c_str());
+}
+
+// 13 samples in batches of 5: the last one holds 3
+void test_last_batch() {
+    size_t i = 0;
+    GeneratorSource source(2, [&i](fp_t* s) { s[0] = i; s[1] = 10 * i; i++; }, 13);
+    DataLoader loader(source, 5, 1);
+
+    Graph g;
+    auto x = g.variable(0, "x");
+    auto y = g.variable(0, "y");
+    auto z = x + y;
+    auto p = x * y;
+    Batch batch = g.batch(5);
+    Minibatch mb;
+    std::vector<size_t> sizes;
+    while (loader.next(mb)) {
+        sizes.push_back(mb.size);
+        mb.load(batch, {x.ptr, y.ptr});
+        g.forward(batch);
+        size_t first = (sizes.size() - 1) * 5;
+        for (size_t k = 0; k < batch.size; k++) {
+            fp_t v = first + std::min(k, mb.size - 1);
+            check(batch.value(z.ptr)[k] == 11 * v, "lanes past the last sample repeat it");
+        }
+        batch.clear_grad();
+        g.backward(batch, p.ptr);
+        fp_t dx = 0;
+        for (size_t k = 0; k < mb.size; k++) dx += 10 * (first + k);
+        check(batch.grad_sum(x.ptr, mb.size) == dx, "gradients of the samples only");
+    }
+    check(sizes == std::vector<size_t>({5, 5, 3}), "a short last batch");
+}
+
+int main(){
+    test_sources();
+    test_load();
+    test_malformed_csv();
+    test_last_batch();
+    std::cout << "Test passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,164 @@
+#include "nn.h"
+#include "nn_blocks.h"
+#include "nn_export.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <cstdio>
+#include <set>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace nn;
+
+void check(bool ok, std::string what) {
+    if (!ok) {
+        std::cout << "[Error] assertion failed: " << what << std::endl;
+        exit(1);
+    }
+}
+
+size_t count(const std::string& text, const std::string& what) {
+    size_t n = 0;
+    for (size_t at = text.find(what); at != std::string::npos; at = text.find(what, at + 1)) n++;
+    return n;
+}
+
+// every id in "inputs" is the id of an earlier line
+bool inputs_come_first(const std::string& text) {
+    std::set<size_t> written;
+    std::istringstream lines(text);
+    for (std::string line; std::getline(lines, line); ) {
+        size_t at = line.find("\"inputs\":[") + 10;
+        while (line[at] != ']') {
+            if (line[at] == ',') at++;
+            size_t end;
+            size_t input = std::stoul(line.substr(at), &end);
+            if (written.count(input) == 0) return false;
+            at += end;
+        }
+        written.insert(std::stoul(line.substr(6)));
+    }
+    return true;
+}
+
+std::string jsonl(const Graph& g, const ExportOptions& options = ExportOptions()) {
+    std::ostringstream out;
+    check(write_jsonl(g, out, options), "jsonl written");
+    check(inputs_come_first(out.str()), "jsonl lines in topological order");
+    return out.str();
+}
+std::string dot(const Graph& g, const ExportOptions& options = ExportOptions()) {
+    std::ostringstream out;
+    check(write_graphviz(g, out, options), "dot written");
+    return out.str();
+}
+
+int main(){
+    // one output of a 6 -> 1 linear layer: 6 muls and a chain of 5 adds
+    Graph g;
+    Node* input[6];
+    for (size_t i = 0; i < 6; i++) input[i] = g.create_var(i, "x" + std::to_string(i));
+    auto layer = linear_layer<6, 1>(g, input, "dense");
+    Node* out = layer.output[0];
+    g.forward();
+    g.backward(out);
+
+    std::string full = jsonl(g);
+    check(count(full, "\n") == 23, "one json line per node");
+    check(full.find("{\"id\":0,\"op\":null,\"name\":\"x0\",\"value\":0,\"grad\":0,\"const\":false,\"inputs\":[]}\n") == 0,
+        "leaf line");
+    check(full.find("\"op\":\"Add\",\"name\":\"dense_output_0\"") != std::string::npos, "op line");
+    std::string graph_dot = dot(g);
+    check(graph_dot == g.to_graphviz(), "to_graphviz is the streamed export");
+    check(count(graph_dot, " -> ") == 22, "two edges per op");
+    check(count(graph_dot, "[label=") == 23, "one dot node per graph node");
+
+    ExportOptions runs;
+    runs.collapse_op_runs = true;
+    std::string collapsed = jsonl(g, runs);
+    check(count(collapsed, "\n") == 6 + 6 + 6 + 1, "the add chain is one summary node");
+    check(collapsed.find("\"group\":\"Add\",\"size\":5") != std::string::npos, "summary node of the add chain");
+    check(count(dot(g, runs), " -> ") == 12 + 6, "edges between summary nodes are not repeated");
+
+    ExportOptions layers;
+    layers.layer = layer_by_name({"_weight", "_output"});
+    std::string by_layer = jsonl(g, layers);
+    check(count(by_layer, "\n") == 6 + 1, "weights, products, sums and output are one layer node");
+    check(by_layer.find("{\"id\":" + std::to_string(out->id) + ",\"group\":\"dense\",\"size\":17,\"inputs\":[0,1,2,3,4,5]}")
+        != std::string::npos, "the layer node only depends on the layer inputs");
+    check(count(dot(g, layers), " -> ") == 6, "no edge back into the layer");
+    runs.layer = layers.layer;
+    check(jsonl(g, runs) == by_layer, "op runs inside a layer stay in the layer");
+
+    // a node consuming a weight, numbered before the layer's last node, is written after the layer
+    Graph side;
+    Node* w = side.create_var(2, "L_weight");
+    Node* x = side.create_var(3, "x");
+    Node* product = side.mul(w, x);
+    Node* reg = side.mul(w, w);
+    Node* l_out = side.add(product, x);
+    l_out->name = "L_output";
+    std::string side_layers = jsonl(side, layers);
+    check(side_layers.find("{\"id\":" + std::to_string(l_out->id) + ",\"group\":\"L\",\"size\":3,\"inputs\":[1]}")
+        != std::string::npos, "the weight, product and output are the layer");
+    check(side_layers.find("\"id\":" + std::to_string(reg->id)) > side_layers.find("\"group\":\"L\""),
+        "the consumer of the weight follows the layer node");
+
+    // A_weight -> B_output -> A_output: merging A would take in B
+    Graph nested;
+    Node* a = nested.create_var(1, "A_weight");
+    Node* b = nested.mul(a, a);
+    b->name = "B_output";
+    Node* c = nested.add(b, a);
+    c->name = "A_output";
+    check(jsonl(nested, layers).find("\"group\"") == std::string::npos, "interleaved layers are not merged");
+
+    ExportOptions depth;
+    depth.root = out;
+    depth.max_depth = 1;
+    std::string near = jsonl(g, depth);
+    check(count(near, "\n") == 3, "root and its inputs");
+    check(count(near, "\"truncated\":true") == 2, "inputs of the last level are cut off");
+    depth.max_depth = 2;
+    check(count(jsonl(g, depth), "\n") == 3 + 4, "two levels below the root");
+    depth.root = input[2];
+    check(count(jsonl(g, depth), "\n") == 1, "a leaf root is exported alone");
+
+    // escaping and non-finite values
+    Graph h;
+    auto q = h.variable(1, "say \"hi\"\\");
+    auto r = q / 0;
+    h.forward();
+    check(std::isinf(r.value()), "division by zero");
+    check(jsonl(h).find("\"name\":\"say \\\"hi\\\"\\\\\"") != std::string::npos, "json string escaping");
+    check(jsonl(h).find("\"value\":null") != std::string::npos, "infinite values are null");
+    Graph ctl;
+    ctl.create_var(1, "two\nlines\t\x01\"q\"");
+    check(jsonl(ctl).find("\"name\":\"two\\u000alines\\u0009\\u0001\\\"q\\\"\"") != std::string::npos,
+        "json control characters");
+    check(dot(ctl).find("[label=\"two\\nlines\\\"q\\\"@") != std::string::npos,
+        "dot labels: line breaks kept, other control characters dropped");
+
+    // a large chain goes through the buffer in many pieces, to a file descriptor
+    Graph big;
+    auto acc = big.variable(1, "seed");
+    for (size_t i = 0; i < 100000; i++) acc = acc * 1.0;
+    big.forward();
+    std::string path = "/tmp/mgrad_t6_" + std::to_string(getpid()) + ".jsonl";
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    check(fd >= 0 && write_jsonl(big, fd), "jsonl written to a file descriptor");
+    close(fd);
+    std::ifstream file(path);
+    std::stringstream content;
+    content << file.rdbuf();
+    check(content.str() == jsonl(big), "same output to streams and file descriptors");
+    check(count(content.str(), "\n") == big.nodes.size(), "one line per node of a large graph");
+    std::remove(path.c_str());
+
+    check(!write_jsonl(big, -1), "write errors are reported");
+
+    std::cout << "Test passed." << std::endl;
+    return 0;
+}
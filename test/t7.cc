@@ -0,0 +1,78 @@
+#include "nn.h"
+#include "nn_blocks.h"
+#include <iostream>
+#include <cmath>
+#include <vector>
+
+using namespace nn;
+
+void check(bool ok, std::string what) {
+    if (!ok) {
+        std::cout << "[Error] assertion failed: " << what << std::endl;
+        exit(1);
+    }
+}
+
+int main(){
+    Graph g;
+    auto x = g.variable(0.3, "x");
+    auto y = g.variable(-1.2, "y");
+    Node* input[2] = {x.ptr, y.ptr};
+    auto l1 = linear_layer<2, 6>(g, input).with_bias().normal_init() << ActivationType::Tanh;
+    auto l2 = linear_layer<6, 3>(g, l1.output).with_bias().normal_init() << ActivationType::Sigmoid;
+    auto extra = (x.sin() * y.cos()).pow(2) + x.abs().log();
+    std::vector<Node*> outputs = {l2.output[0], l2.output[1], l2.output[2], extra.ptr};
+    std::vector<Node*> wrt;
+    for (Node* node: g.nodes) { if (node->op == nullptr && node->requires_grad) wrt.push_back(node); }
+    g.forward();
+
+    // one sweep gives the same rows as one scalar backward pass per output
+    std::vector<fp_t> J = g.jacobian(outputs, wrt);
+    check(J.size() == outputs.size() * wrt.size(), "jacobian shape");
+    for (size_t k = 0; k < outputs.size(); k++) {
+        g.clear_grad();
+        g.backward(outputs[k]);
+        for (size_t j = 0; j < wrt.size(); j++) {
+            check(J[k * wrt.size() + j] == wrt[j]->grad, "jacobian row equals backward of its output");
+        }
+    }
+    check(J[3 * wrt.size()] != 0 && J[3 * wrt.size() + 2] == 0, "an output only depends on its own inputs");
+
+    // weighted roots against an explicit weighted sum
+    std::vector<fp_t> weights = {0.5, -2, 3, 0.25};
+    auto loss = 0.5 * NodeProxy(outputs[0]) - 2 * NodeProxy(outputs[1]) + 3 * NodeProxy(outputs[2]) + 0.25 * extra;
+    g.forward();
+    g.clear_grad();
+    g.backward(loss);
+    std::vector<fp_t> expected;
+    for (Node* node: wrt) { expected.push_back(node->grad); }
+    g.clear_grad();
+    g.backward(outputs, weights);
+    for (size_t j = 0; j < wrt.size(); j++) {
+        check(std::abs(wrt[j]->grad - expected[j]) <= 1e-12 * (1 + std::abs(expected[j])), "weighted roots");
+        fp_t row_sum = 0;
+        for (size_t k = 0; k < outputs.size(); k++) row_sum += weights[k] * J[k * wrt.size() + j];
+        check(std::abs(wrt[j]->grad - row_sum) <= 1e-12 * (1 + std::abs(row_sum)), "weighted roots combine jacobian rows");
+    }
+    g.clear_grad();
+    g.backward(outputs);
+    for (size_t j = 0; j < wrt.size(); j++) {
+        fp_t column_sum = 0;
+        for (size_t k = 0; k < outputs.size(); k++) column_sum += J[k * wrt.size() + j];
+        check(std::abs(wrt[j]->grad - column_sum) <= 1e-12 * (1 + std::abs(column_sum)), "unit weights by default");
+    }
+
+    // weighted roots in every lane of a batch
+    Batch batch = g.batch(5);
+    g.forward(batch);
+    g.backward(batch, outputs, weights);
+    for (size_t j = 0; j < wrt.size(); j++) {
+        for (size_t i = 0; i < batch.size; i++) {
+            check(std::abs(batch.grad(wrt[j])[i] - expected[j]) <= 1e-12 * (1 + std::abs(expected[j])), "batch weighted roots");
+        }
+    }
+
+    check(g.jacobian({}, wrt).empty(), "no outputs");
+    std::cout << "Test passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "nn.h"
+#include "nn_hogwild.h"
+#include <iostream>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <random>
+#include <vector>
+
+using namespace nn;
+
+void check(bool ok, std::string what) {
+    if (!ok) {
+        std::cout << "[Error] assertion failed: " << what << std::endl;
+        exit(1);
+    }
+}
+
+// every update moves both parameters by exactly -0.25, in any order,
+// so a snapshot that splits an update would show a != b
+void test_snapshots() {
+    Graph g;
+    auto a = g.variable(1000, "a");
+    auto b = g.variable(1000, "b");
+    auto loss = 0.5 * a + 0.5 * b;
+    ParameterStore store({a.ptr, b.ptr});
+
+    HogwildOptions options;
+    options.n_threads = 4;
+    options.batch_size = 4;
+    options.learning_rate = 0.5;
+    options.snapshot_every = 7;
+    std::atomic<size_t> n_snapshots{0};
+    std::atomic<bool> consistent{true};
+    options.on_snapshot = [&](const std::vector<fp_t>& p, size_t) {
+        n_snapshots++;
+        if (p[0] != p[1] || std::fmod(1000 - p[0], 0.25) != 0) consistent = false;
+    };
+    std::atomic<long> budget{4000};
+    size_t n = train_hogwild(g, loss.ptr, store, options, [&](size_t, Batch&) { return budget.fetch_sub(1) > 0; });
+    check(n == 4000, "updates until the data runs out");
+    check(consistent, "snapshots hold whole updates");
+    check(n_snapshots == n / 7, "a snapshot every 7 updates");
+    check(store.get(0) == 1000 - 0.25 * n && store.get(1) == 1000 - 0.25 * n, "no update is lost");
+    store.write_back();
+    check(a.value() == store.get(0), "write back");
+}
+
+// noisy linear regression t = 3x - 2y + 1
+void test_regression() {
+    Graph g;
+    auto x = g.variable(0, "x");
+    auto y = g.variable(0, "y");
+    auto t = g.variable(0, "t");
+    auto w0 = g.variable(0, "w0");
+    auto w1 = g.variable(0, "w1");
+    auto c = g.variable(0, "c");
+    auto e = w0 * x + w1 * y + c - t;
+    auto loss = e * e;
+    ParameterStore store({w0.ptr, w1.ptr, c.ptr});
+
+    HogwildOptions options;
+    options.n_threads = 4;
+    options.batch_size = 8;
+    options.learning_rate = 0.05;
+    std::vector<fp_t> losses;
+    std::mutex losses_mutex;
+    options.snapshot_every = 500;
+    options.on_snapshot = [&](const std::vector<fp_t>& p, size_t) {
+        std::lock_guard<std::mutex> lock(losses_mutex);
+        losses.push_back(std::abs(p[0] - 3) + std::abs(p[1] + 2) + std::abs(p[2] - 1));
+    };
+    size_t n = train_hogwild(g, loss.ptr, store, options, [&](size_t worker, Batch& batch) {
+        thread_local std::mt19937 gen;
+        thread_local size_t steps = 0;
+        if (steps == 0) gen.seed(worker);
+        if (steps++ == 1000) return false;
+        std::uniform_real_distribution<fp_t> dist(-1, 1);
+        for (size_t i = 0; i < batch.size; i++) {
+            fp_t u = dist(gen), v = dist(gen);
+            batch.value(x.ptr)[i] = u;
+            batch.value(y.ptr)[i] = v;
+            batch.value(t.ptr)[i] = 3 * u - 2 * v + 1 + 0.01 * dist(gen);
+        }
+        return true;
+    });
+    check(n == 4000, "every worker runs its steps");
+    check(losses.size() == 8, "periodic snapshots");
+    for (fp_t distance: losses) check(distance < 0.05, "converges from a distance of 6");
+    check(std::abs(store.get(0) - 3) < 0.05 && std::abs(store.get(1) + 2) < 0.05, "learned weights");
+}
+
+int main(){
+    test_snapshots();
+    test_regression();
+    std::cout << "Test passed." << std::endl;
+    return 0;
+}
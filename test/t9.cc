@@ -0,0 +1,151 @@
+#include "nn.h"
+#include "nn_blocks.h"
+#include "nn_shm.h"
+#include <iostream>
+#include <cmath>
+#include <functional>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace nn;
+
+void check(bool ok, std::string what) {
+    if (!ok) {
+        std::cout << "[Error] assertion failed: " << what << std::endl;
+        exit(1);
+    }
+}
+
+const size_t N_RANKS = 3;
+
+// runs fn(rank) in N_RANKS processes, rank 0 in this one
+void run_ranks(std::function<void(size_t rank)> fn) {
+    std::vector<pid_t> children;
+    for (size_t rank = 1; rank < N_RANKS; rank++) {
+        pid_t pid = fork();
+        check(pid >= 0, "fork");
+        if (pid == 0) {
+            fn(rank);
+            _exit(0);       // check() exits with 1 on failure
+        }
+        children.push_back(pid);
+    }
+    fn(0);
+    for (pid_t pid: children) {
+        int status = 0;
+        check(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0, "every rank passes");
+    }
+}
+
+std::string group_name(std::string test) { return "/mgrad_t9_" + std::to_string(getpid()) + "_" + test; }
+
+void test_collectives() {
+    std::string name = group_name("collectives");
+    run_ranks([&](size_t rank) {
+        ShmGroup group(name, rank, N_RANKS, 50);
+        std::vector<fp_t> data(50);
+        for (size_t step = 0; step < 300; step++) {
+            size_t n = step * 7 % 50 + 1;
+            for (size_t i = 0; i < n; i++) data[i] = rank * 1000 + step + i;
+            group.all_reduce(data.data(), n);
+            for (size_t i = 0; i < n; i++) {
+                check(data[i] == 3000 + 3. * (step + i), "sum over the ranks");
+            }
+            size_t root = step % N_RANKS;
+            for (size_t i = 0; i < n; i++) data[i] = rank == root ? -(fp_t)i : 12345;
+            group.broadcast(data.data(), n, root);
+            for (size_t i = 0; i < n; i++) check(data[i] == -(fp_t)i, "broadcast from the root");
+        }
+        group.barrier();
+    });
+    check(access(("/dev/shm" + name).c_str(), F_OK) != 0, "the segment name is removed");
+}
+
+struct Net {
+    Graph graph;
+    Node* x;
+    Node* t;
+    Node* loss;
+    std::vector<Node*> params;
+};
+
+void build(Net& net) {
+    Graph& g = net.graph;
+    net.x = g.create_var(0, "x");
+    net.t = g.create_var(0, "t");
+    Node* input[1] = {net.x};
+    auto l1 = linear_layer<1, 4>(g, input).with_bias().normal_init() << ActivationType::Tanh;
+    auto l2 = linear_layer<4, 1>(g, l1.output).with_bias().normal_init();
+    auto e = NodeProxy(l2.output[0]) - NodeProxy(net.t);
+    net.loss = (e * e).ptr;
+    for (Node* node: g.nodes) {
+        if (node->op == nullptr && node != net.x && node != net.t) net.params.push_back(node);
+    }
+}
+
+// sample i of step s, the global batch of a step holds 12 samples
+void sample(size_t s, size_t i, fp_t& x, fp_t& t) {
+    x = std::sin(s * 12 + i);
+    t = x * x - 0.5;
+}
+
+// SGD on the global batch, split over `group`; `lanes` samples per rank
+std::vector<fp_t> train(Net& net, ShmGroup* group, size_t lanes) {
+    const size_t global = 12, steps = 30;
+    const fp_t lr = 0.1;
+    size_t rank = group != nullptr ? group->rank : 0;
+    Batch batch = net.graph.batch(lanes);
+    std::vector<fp_t> grads(net.params.size());
+    for (size_t s = 0; s < steps; s++) {
+        for (size_t k = 0; k < lanes; k++) sample(s, rank * lanes + k, batch.value(net.x)[k], batch.value(net.t)[k]);
+        net.graph.forward(batch);
+        batch.clear_grad();
+        net.graph.backward(batch, net.loss);
+        for (size_t i = 0; i < net.params.size(); i++) grads[i] = batch.grad_sum(net.params[i]);
+        if (group != nullptr) group->all_reduce(grads.data(), grads.size());
+        for (size_t i = 0; i < net.params.size(); i++) {
+            net.params[i]->value -= lr * grads[i] / global;
+            batch.fill(net.params[i], net.params[i]->value);
+        }
+    }
+    std::vector<fp_t> result;
+    for (Node* p: net.params) result.push_back(p->value);
+    return result;
+}
+
+void test_training() {
+    Net single;
+    build(single);
+    std::vector<fp_t> initial;
+    for (Node* p: single.params) initial.push_back(p->value);
+    std::vector<fp_t> expected = train(single, nullptr, 12);
+
+    std::string name = group_name("training");
+    run_ranks([&](size_t rank) {
+        Net net;
+        build(net);         // randomly initialized, until rank 0 broadcasts its parameters
+        ShmGroup group(name, rank, N_RANKS, net.params.size());
+        std::vector<fp_t> params(net.params.size());
+        for (size_t i = 0; i < params.size(); i++) params[i] = rank == 0 ? initial[i] : net.params[i]->value;
+        group.broadcast(params.data(), params.size());
+        for (size_t i = 0; i < params.size(); i++) net.params[i]->value = params[i];
+
+        std::vector<fp_t> result = train(net, &group, 12 / N_RANKS);
+        for (size_t i = 0; i < result.size(); i++) {
+            check(std::abs(result[i] - expected[i]) <= 1e-12 * (1 + std::abs(expected[i])),
+                "same parameters as training on the global batch in one process");
+        }
+        // every rank holds exactly the same parameters
+        std::vector<fp_t> sum = result;
+        group.all_reduce(sum.data(), sum.size());
+        for (size_t i = 0; i < result.size(); i++) check(sum[i] == N_RANKS * result[i], "ranks agree");
+    });
+}
+
+int main(){
+    test_collectives();
+    test_training();
+    std::cout << "Test passed." << std::endl;
+    return 0;
+}
@@ -1,81 +1,120 @@
 // code modified from: https://stackoverflow.com/a/2654860/6775765
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
 #include <cstring>
+#include <functional>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <vector>
 
-template <int w, int h>
-void write_bitmap(
-    std::string fpath,
-    float red[w][h], 
-    float green[w][h], 
-    float blue[w][h]
-){
-
-    FILE *f;
-    unsigned char *img = NULL;
-    int filesize = 54 + 3 * w * h;
+enum class BitmapFormat {
+    RGB24,      // 3 bytes per pixel, in BMP order: blue, green, red
+    Gray8,      // 1 byte per pixel, through a grayscale palette
+};
 
-    img = (unsigned char *)malloc(3*w*h);
-    memset(img,0,3*w*h);
+// Streams a w x h bitmap to `fpath` without holding the image in memory.
+// row(j, pixels) fills the w pixels of row j, j = 0 is the bottom row.
+// Rows go through a small reused buffer and are written in large chunks.
+// Returns false, without creating the file, for an empty or negative size,
+// an unknown format or an image too large for the 32-bit BMP header.
+inline bool write_bitmap(
+    const std::string& fpath, int w, int h, BitmapFormat format,
+    const std::function<void(int j, unsigned char* pixels)>& row
+){
+    if (w <= 0 || h <= 0) return false;
+    if (format != BitmapFormat::Gray8 && format != BitmapFormat::RGB24) return false;
+    const int channels = format == BitmapFormat::Gray8 ? 1 : 3;
+    const size_t row_bytes = (size_t(w) * channels + 3) / 4 * 4;
+    const size_t palette_bytes = format == BitmapFormat::Gray8 ? 256 * 4 : 0;
+    const size_t offset = 54 + palette_bytes;
+    if (row_bytes > (0xffffffffu - offset) / size_t(h)) return false;
+    const size_t filesize = offset + row_bytes * h;
 
-    for(int i=0; i<w; i++)
-    {
-        for(int j=0; j<h; j++)
-        {
-            int x,y;
-            unsigned char r,g,b;
+    unsigned char header[54] = {'B','M', 0,0,0,0, 0,0, 0,0, 0,0,0,0, 40,0,0,0};
+    auto put32 = [&header](int at, size_t v){
+        header[at    ] = (unsigned char)(v    );
+        header[at + 1] = (unsigned char)(v>> 8);
+        header[at + 2] = (unsigned char)(v>>16);
+        header[at + 3] = (unsigned char)(v>>24);
+    };
+    put32( 2, filesize);
+    put32(10, offset);
+    put32(18, w);
+    put32(22, h);
+    header[26] = 1;                                 // planes
+    header[28] = (unsigned char)(channels * 8);     // bits per pixel
+    if (format == BitmapFormat::Gray8) put32(46, 256);
 
-            x=i; y=(h-1)-j;
-            r = red[i][j]*255;
-            g = green[i][j]*255;
-            b = blue[i][j]*255;
-            if (r > 255) r=255;
-            if (g > 255) g=255;
-            if (b > 255) b=255;
-            img[(x+y*w)*3+2] = (unsigned char)(r);
-            img[(x+y*w)*3+1] = (unsigned char)(g);
-            img[(x+y*w)*3+0] = (unsigned char)(b);
+    FILE *f = fopen(fpath.c_str(), "wb");
+    if (f == NULL) return false;
+    bool ok = fwrite(header, 1, 54, f) == 54;
+    if (format == BitmapFormat::Gray8) {
+        unsigned char palette[256 * 4];
+        for (int i = 0; i < 256; i++) {
+            palette[i*4] = palette[i*4+1] = palette[i*4+2] = (unsigned char)i;
+            palette[i*4+3] = 0;
         }
+        ok = ok && fwrite(palette, 1, sizeof(palette), f) == sizeof(palette);
     }
 
-    unsigned char bmpfileheader[14] = {'B','M', 0,0,0,0, 0,0, 0,0, 54,0,0,0};
-    unsigned char bmpinfoheader[40] = {40,0,0,0, 0,0,0,0, 0,0,0,0, 1,0, 24,0};
-    unsigned char bmppad[3] = {0,0,0};
-
-    bmpfileheader[ 2] = (unsigned char)(filesize    );
-    bmpfileheader[ 3] = (unsigned char)(filesize>> 8);
-    bmpfileheader[ 4] = (unsigned char)(filesize>>16);
-    bmpfileheader[ 5] = (unsigned char)(filesize>>24);
-
-    bmpinfoheader[ 4] = (unsigned char)(       w    );
-    bmpinfoheader[ 5] = (unsigned char)(       w>> 8);
-    bmpinfoheader[ 6] = (unsigned char)(       w>>16);
-    bmpinfoheader[ 7] = (unsigned char)(       w>>24);
-    bmpinfoheader[ 8] = (unsigned char)(       h    );
-    bmpinfoheader[ 9] = (unsigned char)(       h>> 8);
-    bmpinfoheader[10] = (unsigned char)(       h>>16);
-    bmpinfoheader[11] = (unsigned char)(       h>>24);
-
-    f = fopen(fpath.c_str(),"wb");
-    fwrite(bmpfileheader,1,14,f);
-    fwrite(bmpinfoheader,1,40,f);
-    for(int i=0; i<h; i++)
-    {
-        fwrite(img+(w*(h-i-1)*3),3,w,f);
-        fwrite(bmppad,1,(4-(w*3)%4)%4,f);
+    // as many whole rows as fit in 256 KiB, at least one
+    const size_t rows_per_chunk = std::max<size_t>(1, (256 << 10) / row_bytes);
+    std::vector<unsigned char> buffer(rows_per_chunk * row_bytes, 0);
+    for (int j0 = 0; ok && j0 < h; j0 += rows_per_chunk) {
+        int n_rows = std::min<int>(rows_per_chunk, h - j0);
+        for (int k = 0; k < n_rows; k++) row(j0 + k, buffer.data() + k * row_bytes);
+        ok = fwrite(buffer.data(), row_bytes, n_rows, f) == size_t(n_rows);
     }
+    return fclose(f) == 0 && ok;
+}
+
+inline unsigned char bitmap_channel(float v){
+    if (!(v > 0)) return 0;
+    if (v > 1) return 255;
+    return (unsigned char)(v * 255);
+}
 
-    free(img);
-    fclose(f);
+// Channels are values in [0, 1] (clamped) at data[i * stride_i + j * stride_j],
+// for pixel column i and row j
+inline bool write_bitmap(
+    const std::string& fpath, int w, int h,
+    const float* red, const float* green, const float* blue,
+    ptrdiff_t stride_i, ptrdiff_t stride_j
+){
+    return write_bitmap(fpath, w, h, BitmapFormat::RGB24, [&](int j, unsigned char* pixels){
+        for (int i = 0; i < w; i++) {
+            ptrdiff_t at = i * stride_i + j * stride_j;
+            pixels[i*3+2] = bitmap_channel(red[at]);
+            pixels[i*3+1] = bitmap_channel(green[at]);
+            pixels[i*3+0] = bitmap_channel(blue[at]);
+        }
+    });
+}
+inline bool write_bitmap(
+    const std::string& fpath, int w, int h,
+    const float* gray, ptrdiff_t stride_i, ptrdiff_t stride_j
+){
+    return write_bitmap(fpath, w, h, BitmapFormat::Gray8, [&](int j, unsigned char* pixels){
+        for (int i = 0; i < w; i++) pixels[i] = bitmap_channel(gray[i * stride_i + j * stride_j]);
+    });
+}
 
+template <int w, int h>
+void write_bitmap(
+    std::string fpath,
+    float red[w][h],
+    float green[w][h],
+    float blue[w][h]
+){
+    write_bitmap(fpath, w, h, &red[0][0], &green[0][0], &blue[0][0], h, 1);
 }
 template <int w, int h>
 void write_bitmap(
     std::string fpath,
-    float gray[w][h] 
+    float gray[w][h]
 ){
     write_bitmap<w, h>(fpath, gray, gray, gray);
-}
\ No newline at end of file
+}